@@ -4,29 +4,173 @@
 
 #include <array>
 #include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
 #include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <deque>
 #include <exception>
+#include <filesystem>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <locale>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <regex>
+#include <set>
 #include <sstream>
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <vector>
 
 #if __has_include(<X11/Xlib.h>) && __has_include(<X11/Xutil.h>)
 #define CRT_HAS_X11 1
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
+#include <poll.h>
 #else
 #define CRT_HAS_X11 0
 #endif
 
+#if defined(__linux__)
+#include <sys/prctl.h>
+#include <time.h>
+#endif
+
+#if __has_include(<sys/inotify.h>)
+#define CRT_HAS_INOTIFY 1
+#include <sys/inotify.h>
+#include <unistd.h>
+#else
+#define CRT_HAS_INOTIFY 0
+#endif
+
+#if __has_include(<sys/mman.h>)
+#define CRT_HAS_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define CRT_HAS_MMAP 0
+#endif
+
+#if __has_include(<png.h>)
+#define CRT_HAS_PNG 1
+#include <png.h>
+#else
+#define CRT_HAS_PNG 0
+#endif
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+#if CRT_HAS_X11 && __has_include(<X11/extensions/XShm.h>)
+#define CRT_HAS_XSHM 1
+#include <X11/extensions/XShm.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#else
+#define CRT_HAS_XSHM 0
+#endif
+
+#if CRT_HAS_X11 && __has_include(<X11/extensions/Xdamage.h>) && __has_include(<X11/extensions/Xfixes.h>)
+#define CRT_HAS_XDAMAGE 1
+#include <X11/extensions/Xdamage.h>
+#include <X11/extensions/Xfixes.h>
+#else
+#define CRT_HAS_XDAMAGE 0
+#endif
+
+#if CRT_HAS_X11 && __has_include(<X11/extensions/Xrandr.h>)
+#define CRT_HAS_XRANDR 1
+#include <X11/extensions/Xrandr.h>
+#else
+#define CRT_HAS_XRANDR 0
+#endif
+
+// Zero-copy capture binds window pixmaps as textures, so it needs the real GLX context SDL created.
+#if CRT_HAS_X11 && __has_include(<SDL2/SDL_syswm.h>) && __has_include(<GL/glx.h>) && \
+    __has_include(<X11/extensions/Xcomposite.h>)
+#define CRT_HAS_COMPOSITE 1
+#include <GL/glx.h>
+#include <SDL2/SDL_syswm.h>
+#include <X11/extensions/Xcomposite.h>
+#else
+#define CRT_HAS_COMPOSITE 0
+#endif
+
 namespace
 {
+    // Uniform buffer binding point of the FrameUniforms block shared by every pass.
+    constexpr GLuint kFrameUniformBinding = 0;
+
+    // PrevTexture is the previous input frame, Prev1Texture..Prev6Texture the six before it.
+    constexpr size_t kHistoryFrames = 7;
+
+    // PassFeedback0..PassFeedback15 may be declared; higher pass indices are not looked up.
+    constexpr size_t kMaxFeedbackPasses = 16;
+
+    enum class LookupWrap
+    {
+        ClampToEdge,
+        ClampToBorder,
+        Repeat,
+        MirroredRepeat
+    };
+
+    // An image a shader samples by name (a LUT or an overlay), declared in a preset's `textures` list or with
+    // `#pragma texture`.
+    struct LookupTextureSpec
+    {
+        std::string name;
+        std::string path;
+        bool linear = true;
+        bool mipmap = false;
+        LookupWrap wrap = LookupWrap::ClampToEdge;
+    };
+
+    // A tunable declared with `#pragma parameter NAME "Description" default min max step`.
+    struct ShaderParameter
+    {
+        std::string name;
+        std::string description;
+        float value = 0.0f;
+        float minimum = 0.0f;
+        float maximum = 0.0f;
+        float step = 0.0f;
+        // Live parameters stay real uniforms; all others are compiled in as constants.
+        bool live = false;
+        GLint location = -1;
+    };
+
+    // A sampler other than Texture, history and feedback, with the unit it reads from and the lookup texture
+    // binding it resolved to (-1 when nothing declares a texture of that name).
+    struct LookupSampler
+    {
+        std::string name;
+        GLint unit = 0;
+        int binding = -1;
+    };
+
     struct ShaderProgram
     {
         GLuint program = 0;
+        std::vector<ShaderParameter> parameters;
+        bool usesFrameBlock = false;
         GLint textureUniform = -1;
         GLint inputSizeUniform = -1;
         GLint textureSizeUniform = -1;
@@ -35,12 +179,42 @@ namespace
         GLint frameDirectionUniform = -1;
         GLint mvpUniform = -1;
         GLint opacityUniform = -1;
+        // Texture unit of each history or feedback sampler the shader declares; 0 (Texture's unit) where it
+        // declares none.
+        std::array<GLint, kHistoryFrames> historyUnits{};
+        std::array<GLint, kMaxFeedbackPasses> feedbackUnits{};
+        // `#pragma texture` declarations in the source, and every other sampler the shader uses, which
+        // attachLookupTextures() resolves against them and the preset's textures.
+        std::vector<LookupTextureSpec> declaredTextures;
+        std::vector<LookupSampler> lookups;
     };
 
+    // std140 layout of the FrameUniforms block; one instance per pass lives in the shared uniform buffer.
+    struct FrameUniformBlock
+    {
+        std::array<float, 16> mvp;
+        std::array<float, 2> outputSize;
+        std::array<float, 2> inputSize;
+        std::array<float, 2> textureSize;
+        std::int32_t frameCount;
+        std::int32_t frameDirection;
+        float windowOpacity;
+        std::array<float, 3> padding;
+    };
+    static_assert(sizeof(FrameUniformBlock) == 112, "FrameUniformBlock must match the std140 block layout");
+
+    constexpr std::array<float, 16> kIdentityMatrix = {1.0f, 0.0f, 0.0f, 0.0f,
+                                                       0.0f, 1.0f, 0.0f, 0.0f,
+                                                       0.0f, 0.0f, 1.0f, 0.0f,
+                                                       0.0f, 0.0f, 0.0f, 1.0f};
+
     struct RenderTarget
     {
         GLuint framebuffer = 0;
         GLuint texture = 0;
+        int width = 0;
+        int height = 0;
+        GLenum format = 0;
     };
 
     void destroyRenderTarget(RenderTarget &target)
@@ -57,29 +231,153 @@ namespace
         }
     }
 
+    // Parameter values and live flags requested on the command line or in a parameter file, by name.
+    struct ParameterSettings
+    {
+        std::map<std::string, float> values;
+        std::set<std::string> live;
+        // The --params file, re-read while running when it changes.
+        std::string file;
+    };
+
+    enum class ScaleType
+    {
+        Source,
+        Viewport,
+        Absolute
+    };
+
+    // How one pass is sized and sampled, from a preset file or defaults for a bare --shader.
+    struct PassSettings
+    {
+        std::string path;
+        ScaleType scaleTypeX = ScaleType::Viewport;
+        ScaleType scaleTypeY = ScaleType::Viewport;
+        float scaleX = 1.0f;
+        float scaleY = 1.0f;
+        bool filterLinear = true;
+        bool floatFramebuffer = false;
+    };
+
+    // Where the pipeline's input comes from: the live desktop, the static test pattern, a GPU procedural source, a
+    // recorded trace, or raw frames piped in for filtering.
+    enum class SourceKind
+    {
+        Desktop,
+        Pattern,
+        Gradient,
+        Text,
+        Noise,
+        Damage,
+        Replay,
+        Filter
+    };
+
     struct Options
     {
         int width = 1280;
         int height = 720;
         float opacity = 0.8f;
-        std::vector<std::string> shaderPaths;
+        bool damage = true;
+        std::string monitor;
+        // Set for --monitor=N; `monitor` then keeps the digits for messages.
+        int monitorIndex = -1;
+        bool compositeCapture = false;
+        // Window id for --capture=composite:ID; zero means every top-level window.
+        unsigned long compositeWindow = 0;
+        bool stats = false;
+        bool hud = false;
+        int benchmarkFrames = 0;
+        SourceKind source = SourceKind::Desktop;
+        std::string recordPath;
+        std::string replayPath;
+        bool replayRealtime = true;
+        // Raw RGBA frames in ("-" for stdin), filtered frames out on stdout.
+        std::string filterInput;
+        // Zero means the window size.
+        int sourceWidth = 0;
+        int sourceHeight = 0;
+        float captureFps = 0.0f;
+        float maxFps = 0.0f;
+        int swapInterval = 1;
+        // Milliseconds of GPU time per frame the render governor aims for; zero renders at full size.
+        float frameBudget = 0.0f;
+        float minRenderScale = 0.5f;
+        float maxRenderScale = 1.0f;
+        int uploadBuffers = 3;
+        bool captureWindowRegion = false;
+        int captureMargin = 64;
+        std::vector<PassSettings> passes;
+        std::vector<LookupTextureSpec> lookupTextures;
+        ParameterSettings parameters;
+        bool listParameters = false;
+        bool shaderCache = true;
+    };
+
+    // A changed region of the desktop, with its rows exactly as the X server delivered them.
+    struct CaptureRect
+    {
+        int x = 0;
+        int y = 0;
+        int width = 0;
+        int height = 0;
+        const std::uint8_t *data = nullptr;
+        int bytesPerLine = 0;
+    };
+
+    // Part of the root window to capture; an empty region means the whole root.
+    struct CaptureRegion
+    {
+        int x = 0;
+        int y = 0;
+        int width = 0;
+        int height = 0;
+    };
+
+    // What the capture thread grabs.
+    struct CaptureSettings
+    {
+        bool trackDamage = true;
+        // Empty for the whole root, "auto" for the monitor under the window, or a monitor index or output name.
+        std::string monitor;
+        // The index parsed from `monitor`, or -1 when it is not one.
+        int monitorIndex = -1;
+        // Capture the region set by the render loop rather than the whole root or monitor; otherwise that region
+        // only locates the window for "auto".
+        bool windowRegion = false;
     };
 
-    struct ExclusionRect
+    // Raw desktop pixels plus their pixel format; unpacked on the GPU by kUnpackShader.
+    struct CaptureFrame
     {
-        float x = 0.0f;
-        float y = 0.0f;
-        float width = 0.0f;
-        float height = 0.0f;
-        bool valid = false;
+        int originX = 0;
+        int originY = 0;
+        int width = 0;
+        int height = 0;
+        int bitsPerPixel = 32;
+        unsigned long redMask = 0;
+        unsigned long greenMask = 0;
+        unsigned long blueMask = 0;
+        bool msbFirst = false;
+        std::vector<CaptureRect> rects;
+        std::uint64_t damagedPixels = 0;
+        const char *backend = "unavailable";
     };
 
     constexpr std::string_view kDefaultShader = R"GLSL(
+        layout(std140) uniform FrameUniforms {
+            mat4 MVPMatrix;
+            vec2 OutputSize;
+            vec2 InputSize;
+            vec2 TextureSize;
+            int FrameCount;
+            int FrameDirection;
+            float WindowOpacity;
+        };
         #if defined(VERTEX)
         layout(location = 0) in vec4 VertexCoord;
         layout(location = 1) in vec2 TexCoord;
         out vec2 TEX0;
-        uniform mat4 MVPMatrix;
         void main() {
             gl_Position = MVPMatrix * VertexCoord;
             TEX0 = TexCoord;
@@ -88,8 +386,6 @@ namespace
         in vec2 TEX0;
         out vec4 FragColor;
         uniform sampler2D Texture;
-        uniform vec2 InputSize;
-        uniform float WindowOpacity;
         void main() {
             vec2 uv = TEX0;
             vec3 base = texture(Texture, uv).rgb;
@@ -100,7 +396,7 @@ namespace
         #endif
     )GLSL";
 
-    constexpr std::string_view kExclusionShader = R"GLSL(
+    constexpr std::string_view kHudShader = R"GLSL(
         #if defined(VERTEX)
         layout(location = 0) in vec4 VertexCoord;
         layout(location = 1) in vec2 TexCoord;
@@ -112,21 +408,91 @@ namespace
         #elif defined(FRAGMENT)
         in vec2 TEX0;
         out vec4 FragColor;
-        uniform sampler2D CurrentTexture;
-        uniform sampler2D BackgroundTexture;
-        uniform vec4 ExclusionRect;
-        uniform bool HasExclusion;
+        uniform sampler2D Texture;
         void main() {
-            vec4 current = texture(CurrentTexture, TEX0);
-            if (HasExclusion) {
-                vec2 minCorner = ExclusionRect.xy;
-                vec2 maxCorner = ExclusionRect.xy + ExclusionRect.zw;
-                if (TEX0.x >= minCorner.x && TEX0.x <= maxCorner.x && TEX0.y >= minCorner.y && TEX0.y <= maxCorner.y) {
-                    FragColor = texture(BackgroundTexture, TEX0);
-                    return;
-                }
+            FragColor = texture(Texture, TEX0);
+        }
+        #endif
+    )GLSL";
+
+    // Procedural test sources. Mode 0: moving gradient, 1: scrolling text-like glyph rows, 2: per-pixel noise
+    // that changes every frame.
+    constexpr std::string_view kSourceShader = R"GLSL(
+        #if defined(VERTEX)
+        layout(location = 0) in vec4 VertexCoord;
+        void main() {
+            gl_Position = VertexCoord;
+        }
+        #elif defined(FRAGMENT)
+        out vec4 FragColor;
+        uniform int Mode;
+        uniform int Frame;
+        uniform vec2 Size;
+        uint hash(uvec3 v) {
+            uint h = v.x * 1664525u + v.y * 22695477u + v.z * 2891336453u;
+            h ^= h >> 16u;
+            h *= 2246822519u;
+            h ^= h >> 13u;
+            h *= 3266489917u;
+            return h ^ (h >> 16u);
+        }
+        void main() {
+            vec2 uv = gl_FragCoord.xy / Size;
+            if (Mode == 0) {
+                float t = float(Frame) * 0.01;
+                vec3 phase = vec3(0.0, 2.094, 4.189);
+                FragColor = vec4(0.5 + 0.5 * cos(6.2832 * (uv.x + 0.5 * uv.y + t) + phase), 1.0);
+            } else if (Mode == 1) {
+                ivec2 p = ivec2(gl_FragCoord.xy) + ivec2(0, Frame * 2);
+                ivec2 cell = p / ivec2(8, 16);
+                ivec2 inCell = p - cell * ivec2(8, 16);
+                uint glyph = hash(uvec3(cell, 7u));
+                bool space = (glyph & 7u) == 0u || (hash(uvec3(0u, cell.y, 3u)) & 3u) == 0u;
+                bool inGlyph = inCell.x < 5 && inCell.y >= 4 && inCell.y < 11;
+                bool ink = !space && inGlyph && ((glyph >> uint((inCell.y - 4) * 5 + inCell.x) % 29u) & 1u) == 1u;
+                FragColor = ink ? vec4(0.1, 0.1, 0.12, 1.0) : vec4(0.95, 0.95, 0.92, 1.0);
+            } else {
+                uint h = hash(uvec3(uvec2(gl_FragCoord.xy), uint(Frame)));
+                FragColor = vec4(vec3(h & 255u, (h >> 8u) & 255u, (h >> 16u) & 255u) / 255.0, 1.0);
+            }
+        }
+        #endif
+    )GLSL";
+
+    constexpr std::string_view kUnpackShader = R"GLSL(
+        #if defined(VERTEX)
+        layout(location = 0) in vec4 VertexCoord;
+        void main() {
+            gl_Position = VertexCoord;
+        }
+        #elif defined(FRAGMENT)
+        out vec4 FragColor;
+        uniform usampler2D RawTexture;
+        uniform int BytesPerPixel;
+        uniform bool MsbFirst;
+        uniform ivec3 ChannelShift;
+        uniform ivec3 ChannelBits;
+        float channel(uint pixel, int shift, int bits) {
+            if (bits <= 0) {
+                return 0.0;
+            }
+            uint maxValue = (1u << uint(bits)) - 1u;
+            return float((pixel >> uint(shift)) & maxValue) / float(maxValue);
+        }
+        void main() {
+            ivec2 texel = ivec2(gl_FragCoord.xy);
+            uvec4 b = texelFetch(RawTexture, texel, 0);
+            uint pixel;
+            if (BytesPerPixel == 4) {
+                pixel = MsbFirst ? ((b.r << 24) | (b.g << 16) | (b.b << 8) | b.a)
+                                 : (b.r | (b.g << 8) | (b.b << 16) | (b.a << 24));
+            } else {
+                pixel = MsbFirst ? ((b.r << 16) | (b.g << 8) | b.b) : (b.r | (b.g << 8) | (b.b << 16));
             }
-            FragColor = current;
+            FragColor = vec4(channel(pixel, ChannelShift.r, ChannelBits.r),
+                             channel(pixel, ChannelShift.g, ChannelBits.g),
+                             channel(pixel, ChannelShift.b, ChannelBits.b),
+                             1.0);
         }
         #endif
     )GLSL";
@@ -139,6 +505,21 @@ namespace
         }
     }
 
+    bool hasGLExtension(std::string_view name)
+    {
+        GLint count = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        for (GLint i = 0; i < count; ++i)
+        {
+            const auto *extension = reinterpret_cast<const char *>(glGetStringi(GL_EXTENSIONS, static_cast<GLuint>(i)));
+            if (extension && name == extension)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
     std::string loadFile(const std::string &path)
     {
         std::ifstream stream(path, std::ios::in | std::ios::binary);
@@ -152,13 +533,18 @@ namespace
         return buffer.str();
     }
 
-    GLuint compileShader(GLenum type, const std::string &source)
+    // Only issues the compile; the status is checked in checkShader once every pass has been submitted.
+    GLuint submitShader(GLenum type, const std::string &source)
     {
         GLuint shader = glCreateShader(type);
         const char *raw = source.c_str();
         glShaderSource(shader, 1, &raw, nullptr);
         glCompileShader(shader);
+        return shader;
+    }
 
+    void checkShader(GLuint shader, const std::string &name)
+    {
         GLint status = GL_FALSE;
         glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
         if (status != GL_TRUE)
@@ -167,46 +553,40 @@ namespace
             glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &logLength);
             std::string log(static_cast<size_t>(logLength), '\0');
             glGetShaderInfoLog(shader, logLength, nullptr, log.data());
-            glDeleteShader(shader);
-            throw std::runtime_error("Shader compile error: " + log);
+            throw std::runtime_error(name + ": Shader compile error: " + log);
         }
-
-        return shader;
     }
 
-    ShaderProgram buildShaderProgram(const std::string &source)
+    // Lets the driver compile and link on its own threads, so submitted passes build concurrently.
+    bool enableParallelShaderCompile()
     {
-        const std::string header = "#version 330 core\n";
-
-        std::string vertexSource = header + "#define VERTEX\n" + source;
-        std::string fragmentSource = header + "#define FRAGMENT\n" + source;
-
-        GLuint vertexShader = compileShader(GL_VERTEX_SHADER, vertexSource);
-        GLuint fragmentShader = compileShader(GL_FRAGMENT_SHADER, fragmentSource);
-
-        GLuint program = glCreateProgram();
-        glAttachShader(program, vertexShader);
-        glAttachShader(program, fragmentShader);
-        glBindAttribLocation(program, 0, "VertexCoord");
-        glBindAttribLocation(program, 1, "TexCoord");
-        glBindAttribLocation(program, 2, "COLOR");
-        glLinkProgram(program);
-
-        glDeleteShader(vertexShader);
-        glDeleteShader(fragmentShader);
+        const char *entry = nullptr;
+        if (hasGLExtension("GL_KHR_parallel_shader_compile"))
+        {
+            entry = "glMaxShaderCompilerThreadsKHR";
+        }
+        else if (hasGLExtension("GL_ARB_parallel_shader_compile"))
+        {
+            entry = "glMaxShaderCompilerThreadsARB";
+        }
+        if (!entry)
+        {
+            return false;
+        }
 
-        GLint linkStatus = GL_FALSE;
-        glGetProgramiv(program, GL_LINK_STATUS, &linkStatus);
-        if (linkStatus != GL_TRUE)
+        using MaxShaderCompilerThreads = void (*)(GLuint);
+        const auto maxThreads = reinterpret_cast<MaxShaderCompilerThreads>(SDL_GL_GetProcAddress(entry));
+        if (!maxThreads)
         {
-            GLint logLength = 0;
-            glGetProgramiv(program, GL_INFO_LOG_LENGTH, &logLength);
-            std::string log(static_cast<size_t>(logLength), '\0');
-            glGetProgramInfoLog(program, logLength, nullptr, log.data());
-            glDeleteProgram(program);
-            throw std::runtime_error("Program link error: " + log);
+            return false;
         }
+        maxThreads(0xFFFFFFFFu);
+        return true;
+    }
 
+    // Resolves every uniform location once, right after linking.
+    ShaderProgram wrapProgram(GLuint program)
+    {
         ShaderProgram wrapped;
         wrapped.program = program;
         wrapped.textureUniform = glGetUniformLocation(program, "Texture");
@@ -218,475 +598,5619 @@ namespace
         wrapped.mvpUniform = glGetUniformLocation(program, "MVPMatrix");
         wrapped.opacityUniform = glGetUniformLocation(program, "WindowOpacity");
 
-        return wrapped;
-    }
+        const GLuint frameBlock = glGetUniformBlockIndex(program, "FrameUniforms");
+        if (frameBlock != GL_INVALID_INDEX)
+        {
+            glUniformBlockBinding(program, frameBlock, kFrameUniformBinding);
+            wrapped.usesFrameBlock = true;
+        }
 
-    ShaderProgram buildShaderFromFile(const std::string &path)
-    {
-        const std::string fileSource = loadFile(path);
-        return buildShaderProgram(fileSource);
-    }
+        // Values that never change are set once here instead of every frame.
+        glUseProgram(program);
+        if (wrapped.textureUniform >= 0)
+        {
+            glUniform1i(wrapped.textureUniform, 0);
+        }
+        if (wrapped.frameDirectionUniform >= 0)
+        {
+            glUniform1i(wrapped.frameDirectionUniform, 1);
+        }
+        if (wrapped.mvpUniform >= 0)
+        {
+            glUniformMatrix4fv(wrapped.mvpUniform, 1, GL_FALSE, kIdentityMatrix.data());
+        }
 
-    GLuint buildFullscreenVAO()
-    {
-        std::array<float, 36> vertices = {
-            // positions      // tex coords
-            -1.0f, -1.0f, 0.0f, 1.0f, 0.0f, 0.0f,
-             1.0f, -1.0f, 0.0f, 1.0f, 1.0f, 0.0f,
-             1.0f,  1.0f, 0.0f, 1.0f, 1.0f, 1.0f,
-            -1.0f, -1.0f, 0.0f, 1.0f, 0.0f, 0.0f,
-             1.0f,  1.0f, 0.0f, 1.0f, 1.0f, 1.0f,
-            -1.0f,  1.0f, 0.0f, 1.0f, 0.0f, 1.0f,
+        // Unit 0 is Texture; the history and feedback samplers a shader actually uses get the next free units,
+        // and unused ones are optimized out by the compiler and cost nothing.
+        GLint nextUnit = 1;
+        const auto assignUnit = [&](const std::string &name) {
+            const GLint location = glGetUniformLocation(program, name.c_str());
+            if (location < 0)
+            {
+                return 0;
+            }
+            glUniform1i(location, nextUnit);
+            return nextUnit++;
         };
+        for (size_t age = 0; age < kHistoryFrames; ++age)
+        {
+            wrapped.historyUnits[age] = assignUnit(age == 0 ? "PrevTexture" : "Prev" + std::to_string(age) + "Texture");
+        }
+        for (size_t pass = 0; pass < kMaxFeedbackPasses; ++pass)
+        {
+            wrapped.feedbackUnits[pass] = assignUnit("PassFeedback" + std::to_string(pass));
+        }
+        glUseProgram(0);
 
-        GLuint vao = 0;
-        GLuint vbo = 0;
-        glGenVertexArrays(1, &vao);
-        glGenBuffers(1, &vbo);
-
-        glBindVertexArray(vao);
-        glBindBuffer(GL_ARRAY_BUFFER, vbo);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices.data(), GL_STATIC_DRAW);
-
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 6 * sizeof(float), reinterpret_cast<void *>(0));
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 6 * sizeof(float), reinterpret_cast<void *>(4 * sizeof(float)));
-
-        glBindVertexArray(0);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-        return vao;
+        return wrapped;
     }
 
-    GLuint createTexture(int width, int height, const std::vector<std::uint8_t> &initialData)
+    // On-disk store of linked program binaries, keyed by the full shader sources and the GL driver identity.
+    struct ProgramCache
     {
-        GLuint texture = 0;
-        glGenTextures(1, &texture);
-        glBindTexture(GL_TEXTURE_2D, texture);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE,
-                     initialData.empty() ? nullptr : initialData.data());
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glBindTexture(GL_TEXTURE_2D, 0);
-        return texture;
-    }
+        std::filesystem::path directory;
+        std::uint64_t driverHash = 0;
+        int hits = 0;
+        int misses = 0;
+    };
 
-    RenderTarget createRenderTarget(int width, int height)
+    std::uint64_t fnv1a(std::string_view data, std::uint64_t hash = 0xcbf29ce484222325ull)
     {
-        RenderTarget target;
-        target.texture = createTexture(width, height, {});
-        glGenFramebuffers(1, &target.framebuffer);
-        glBindFramebuffer(GL_FRAMEBUFFER, target.framebuffer);
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target.texture, 0);
-
-        const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-        if (status != GL_FRAMEBUFFER_COMPLETE)
+        for (const char c : data)
         {
-            throw std::runtime_error("Framebuffer incomplete");
+            hash ^= static_cast<unsigned char>(c);
+            hash *= 0x100000001b3ull;
         }
+        return hash;
+    }
 
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        return target;
+    std::string glString(GLenum name)
+    {
+        const auto *value = reinterpret_cast<const char *>(glGetString(name));
+        return value ? value : "";
     }
 
-    std::vector<std::uint8_t> buildTestPattern(int width, int height)
+    // Returns a cache with an empty directory (disabled) when the driver cannot hand out program binaries.
+    ProgramCache openProgramCache(bool enabled)
     {
-        std::vector<std::uint8_t> data(static_cast<size_t>(width * height * 4));
-        for (int y = 0; y < height; ++y)
+        ProgramCache cache;
+        GLint formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        if (!enabled || formats <= 0)
         {
-            for (int x = 0; x < width; ++x)
-            {
-                const float xf = static_cast<float>(x) / static_cast<float>(width);
-                const float yf = static_cast<float>(y) / static_cast<float>(height);
-                const size_t idx = static_cast<size_t>((y * width + x) * 4);
-                data[idx + 0] = static_cast<std::uint8_t>(255.0f * xf);
-                data[idx + 1] = static_cast<std::uint8_t>(255.0f * (1.0f - xf));
-                data[idx + 2] = static_cast<std::uint8_t>(255.0f * yf);
-                data[idx + 3] = 255;
-            }
+            return cache;
         }
-        return data;
-    }
 
-    int maskShift(unsigned long mask)
-    {
-        if (mask == 0)
+        std::filesystem::path base;
+        if (const char *xdgCache = std::getenv("XDG_CACHE_HOME"); xdgCache && *xdgCache)
         {
-            return 0;
+            base = xdgCache;
         }
-        int shift = 0;
-        while ((mask & 1u) == 0u)
+        else if (const char *home = std::getenv("HOME"); home && *home)
         {
-            mask >>= 1;
-            ++shift;
+            base = std::filesystem::path(home) / ".cache";
+        }
+        else
+        {
+            return cache;
         }
-        return shift;
-    }
 
-    int maskSize(unsigned long mask)
-    {
-        int size = 0;
-        while (mask)
+        std::error_code error;
+        std::filesystem::create_directories(base / "crt" / "programs", error);
+        if (error)
         {
-            size += static_cast<int>(mask & 1u);
-            mask >>= 1;
+            std::cerr << "Shader cache disabled: " << error.message() << "\n";
+            return cache;
         }
-        return size;
+        cache.directory = base / "crt" / "programs";
+        cache.driverHash = fnv1a(glString(GL_VENDOR) + '\n' + glString(GL_RENDERER) + '\n' + glString(GL_VERSION));
+        return cache;
     }
 
-    float normalizeChannel(unsigned long value, unsigned long mask)
+    constexpr std::uint32_t kProgramBinaryMagic = 0x50545243u; // "CRTP"
+
+    bool loadCachedProgram(ProgramCache &cache, const std::filesystem::path &path, GLuint program)
     {
-        const int shift = maskShift(mask);
-        const int bits = maskSize(mask);
-        const unsigned long component = (value & mask) >> shift;
-        if (bits <= 0)
+        std::ifstream stream(path, std::ios::in | std::ios::binary);
+        std::uint32_t magic = 0;
+        GLenum format = 0;
+        if (!stream || !stream.read(reinterpret_cast<char *>(&magic), sizeof(magic)) ||
+            !stream.read(reinterpret_cast<char *>(&format), sizeof(format)) || magic != kProgramBinaryMagic)
+        {
+            return false;
+        }
+        const std::vector<char> binary((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+
+        glProgramBinary(program, format, binary.data(), static_cast<GLsizei>(binary.size()));
+        GLint linkStatus = GL_FALSE;
+        glGetProgramiv(program, GL_LINK_STATUS, &linkStatus);
+        if (linkStatus != GL_TRUE)
         {
-            return 0.0f;
+            // Stale after a driver update or rejected for another reason; it is rebuilt from source.
+            std::error_code error;
+            std::filesystem::remove(path, error);
+            return false;
         }
-        const unsigned long maxValue = (1u << bits) - 1u;
-        return static_cast<float>(component) / static_cast<float>(maxValue);
+        cache.hits++;
+        return true;
     }
 
-#if CRT_HAS_X11
-    class ScreenCapture
+    void storeCachedProgram(const std::filesystem::path &path, GLuint program)
     {
-    public:
-        ScreenCapture()
+        GLint length = 0;
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
         {
-            display_ = XOpenDisplay(nullptr);
-            if (display_)
-            {
-                root_ = DefaultRootWindow(display_);
-            }
+            return;
         }
+        std::vector<char> binary(static_cast<size_t>(length));
+        GLenum format = 0;
+        glGetProgramBinary(program, length, nullptr, &format, binary.data());
 
-        ~ScreenCapture()
+        // Write to a temporary name first so a concurrent launch never reads a half-written binary.
+        std::filesystem::path temporary = path;
+        temporary += ".tmp";
         {
-            releaseImage();
-            if (display_)
+            std::ofstream stream(temporary, std::ios::out | std::ios::binary | std::ios::trunc);
+            stream.write(reinterpret_cast<const char *>(&kProgramBinaryMagic), sizeof(kProgramBinaryMagic));
+            stream.write(reinterpret_cast<const char *>(&format), sizeof(format));
+            stream.write(binary.data(), static_cast<std::streamsize>(binary.size()));
+            if (!stream)
             {
-                XCloseDisplay(display_);
+                return;
             }
         }
+        std::error_code error;
+        std::filesystem::rename(temporary, path, error);
+    }
 
-        bool grab(std::vector<std::uint8_t> &buffer, int &width, int &height)
-        {
+    // A program whose compile and link have been issued but not yet checked.
+    struct PendingProgram
+    {
+        std::string name;
+        GLuint program = 0;
+        GLuint vertexShader = 0;
+        GLuint fragmentShader = 0;
+        std::filesystem::path cachePath;
+        std::vector<ShaderParameter> parameters;
+        std::vector<LookupTextureSpec> textures;
+    };
+
+    void destroyPendingProgram(PendingProgram &pending)
+    {
+        glDeleteShader(pending.vertexShader);
+        glDeleteShader(pending.fragmentShader);
+        glDeleteProgram(pending.program);
+        pending = PendingProgram{};
+    }
+
+    // #version must be the first directive, so a version the source declares itself is blanked out in favour of
+    // the header submitShaderProgram prepends; the line stays so compiler messages keep their line numbers.
+    std::string blankVersionDirective(std::string source)
+    {
+        const size_t directive = source.find_first_not_of(" \t\r\n");
+        if (directive != std::string::npos && source.compare(directive, 8, "#version") == 0)
+        {
+            const size_t end = source.find('\n', directive);
+            source.erase(directive, end == std::string::npos ? std::string::npos : end - directive);
+        }
+        return source;
+    }
+
+    PendingProgram submitShaderProgram(const std::string &source, ProgramCache &cache, std::string name)
+    {
+        const std::string header = "#version 330 core\n";
+        const std::string body = blankVersionDirective(source);
+
+        std::string vertexSource = header + "#define VERTEX\n" + body;
+        std::string fragmentSource = header + "#define FRAGMENT\n" + body;
+
+        PendingProgram pending;
+        pending.name = std::move(name);
+        pending.program = glCreateProgram();
+        if (!cache.directory.empty())
+        {
+            std::ostringstream file;
+            file << std::hex << std::setw(16) << std::setfill('0')
+                 << fnv1a(fragmentSource, fnv1a(vertexSource, cache.driverHash)) << ".bin";
+            if (loadCachedProgram(cache, cache.directory / file.str(), pending.program))
+            {
+                return pending;
+            }
+            cache.misses++;
+            pending.cachePath = cache.directory / file.str();
+            glDeleteProgram(pending.program);
+            pending.program = glCreateProgram();
+            glProgramParameteri(pending.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        }
+
+        pending.vertexShader = submitShader(GL_VERTEX_SHADER, vertexSource);
+        pending.fragmentShader = submitShader(GL_FRAGMENT_SHADER, fragmentSource);
+
+        glAttachShader(pending.program, pending.vertexShader);
+        glAttachShader(pending.program, pending.fragmentShader);
+        glBindAttribLocation(pending.program, 0, "VertexCoord");
+        glBindAttribLocation(pending.program, 1, "TexCoord");
+        glBindAttribLocation(pending.program, 2, "COLOR");
+        glLinkProgram(pending.program);
+        return pending;
+    }
+
+    // Blocks on the driver for this program; the first status query is where compile latency is paid.
+    ShaderProgram finishShaderProgram(PendingProgram &pending)
+    {
+        try
+        {
+            if (pending.vertexShader != 0)
+            {
+                checkShader(pending.vertexShader, pending.name + " (vertex)");
+                checkShader(pending.fragmentShader, pending.name + " (fragment)");
+            }
+
+            GLint linkStatus = GL_FALSE;
+            glGetProgramiv(pending.program, GL_LINK_STATUS, &linkStatus);
+            if (linkStatus != GL_TRUE)
+            {
+                GLint logLength = 0;
+                glGetProgramiv(pending.program, GL_INFO_LOG_LENGTH, &logLength);
+                std::string log(static_cast<size_t>(logLength), '\0');
+                glGetProgramInfoLog(pending.program, logLength, nullptr, log.data());
+                throw std::runtime_error(pending.name + ": Program link error: " + log);
+            }
+        }
+        catch (...)
+        {
+            destroyPendingProgram(pending);
+            throw;
+        }
+
+        glDeleteShader(pending.vertexShader);
+        glDeleteShader(pending.fragmentShader);
+        if (!pending.cachePath.empty())
+        {
+            storeCachedProgram(pending.cachePath, pending.program);
+        }
+
+        ShaderProgram program = wrapProgram(pending.program);
+
+        // Live parameters, and any whose declaration could not be rewritten, are set as uniforms once.
+        glUseProgram(program.program);
+        for (auto &parameter : pending.parameters)
+        {
+            parameter.location = glGetUniformLocation(program.program, parameter.name.c_str());
+            if (parameter.location >= 0)
+            {
+                glUniform1f(parameter.location, parameter.value);
+            }
+        }
+        glUseProgram(0);
+
+        program.parameters = std::move(pending.parameters);
+        program.declaredTextures = std::move(pending.textures);
+        pending = PendingProgram{};
+        return program;
+    }
+
+    ShaderProgram buildShaderProgram(const std::string &source, ProgramCache &cache, std::string name)
+    {
+        PendingProgram pending = submitShaderProgram(source, cache, std::move(name));
+        return finishShaderProgram(pending);
+    }
+
+    std::vector<ShaderParameter> parseParameters(const std::string &source)
+    {
+        static const std::regex pragma(R"re(^\s*#pragma\s+parameter\s+(\w+)\s+"([^"]*)"\s+(\S+)\s+(\S+)\s+(\S+)(?:\s+(\S+))?)re");
+
+        std::vector<ShaderParameter> parameters;
+        std::istringstream lines(source);
+        std::string line;
+        while (std::getline(lines, line))
+        {
+            std::smatch match;
+            if (!std::regex_search(line, match, pragma))
+            {
+                continue;
+            }
+            const std::string name = match[1].str();
+            const bool duplicate = std::any_of(parameters.begin(), parameters.end(),
+                                               [&name](const ShaderParameter &parameter) { return parameter.name == name; });
+            if (duplicate)
+            {
+                continue;
+            }
+
+            ShaderParameter parameter;
+            parameter.name = name;
+            parameter.description = match[2].str();
+            try
+            {
+                parameter.value = std::stof(match[3].str());
+                parameter.minimum = std::stof(match[4].str());
+                parameter.maximum = std::stof(match[5].str());
+                parameter.step = match[6].matched ? std::stof(match[6].str()) : 0.0f;
+            }
+            catch (const std::exception &)
+            {
+                std::cerr << "Ignoring malformed parameter pragma: " << line << "\n";
+                continue;
+            }
+            parameters.push_back(parameter);
+        }
+        return parameters;
+    }
+
+    // Accepts the RetroArch `wrap_mode` names.
+    LookupWrap parseLookupWrap(const std::string &value, const std::string &path)
+    {
+        if (value == "clamp_to_edge")
+        {
+            return LookupWrap::ClampToEdge;
+        }
+        if (value == "clamp_to_border")
+        {
+            return LookupWrap::ClampToBorder;
+        }
+        if (value == "repeat")
+        {
+            return LookupWrap::Repeat;
+        }
+        if (value == "mirrored_repeat")
+        {
+            return LookupWrap::MirroredRepeat;
+        }
+        throw std::runtime_error("Unknown wrap mode in " + path + ": " + value);
+    }
+
+    // Reads `#pragma texture NAME "FILE" [linear|nearest] [mipmap] [WRAP_MODE]` lines. FILE is relative to the
+    // shader; a preset texture of the same name is overridden for this pass.
+    std::vector<LookupTextureSpec> parseLookupTextures(const std::string &source, const std::string &shaderPath)
+    {
+        static const std::regex pragma(R"re(^\s*#pragma\s+texture\s+(\w+)\s+"([^"]*)"((?:\s+\w+)*))re");
+
+        const std::filesystem::path directory = std::filesystem::path(shaderPath).parent_path();
+        std::vector<LookupTextureSpec> textures;
+        std::istringstream lines(source);
+        std::string line;
+        while (std::getline(lines, line))
+        {
+            std::smatch match;
+            if (!std::regex_search(line, match, pragma))
+            {
+                continue;
+            }
+            LookupTextureSpec texture;
+            texture.name = match[1].str();
+            texture.path = (directory / match[2].str()).lexically_normal().string();
+            std::istringstream flags(match[3].str());
+            std::string flag;
+            try
+            {
+                while (flags >> flag)
+                {
+                    if (flag == "linear" || flag == "nearest")
+                    {
+                        texture.linear = flag == "linear";
+                    }
+                    else if (flag == "mipmap")
+                    {
+                        texture.mipmap = true;
+                    }
+                    else
+                    {
+                        texture.wrap = parseLookupWrap(flag, shaderPath);
+                    }
+                }
+            }
+            catch (const std::exception &error)
+            {
+                std::cerr << "Ignoring malformed texture pragma: " << error.what() << "\n";
+                continue;
+            }
+            textures.push_back(texture);
+        }
+        return textures;
+    }
+
+    std::string formatGLSLFloat(float value)
+    {
+        std::ostringstream stream;
+        stream.imbue(std::locale::classic());
+        stream << std::showpoint << std::setprecision(9) << value;
+        return stream.str();
+    }
+
+    // Rewrites the uniform declaration of every non-live parameter into a constant, so the GLSL compiler can fold
+    // it and drop the branches it disables. PARAMETER_UNIFORM selects the declarations in libretro shaders.
+    std::string specializeParameters(const std::string &source, const std::vector<ShaderParameter> &parameters)
+    {
+        static const std::regex declaration(R"re(^\s*uniform\s+(?:(\w+)\s+)?float\s+(\w+)\s*;)re");
+
+        std::string specialized = "#define PARAMETER_UNIFORM\n";
+        specialized.reserve(source.size() + 64);
+        std::istringstream lines(source);
+        std::string line;
+        while (std::getline(lines, line))
+        {
+            std::smatch match;
+            if (std::regex_search(line, match, declaration))
+            {
+                const std::string name = match[2].str();
+                const auto parameter = std::find_if(parameters.begin(), parameters.end(),
+                                                    [&name](const ShaderParameter &entry) { return entry.name == name; });
+                if (parameter != parameters.end() && !parameter->live)
+                {
+                    const std::string qualifier = match[1].matched ? match[1].str() + " " : "";
+                    line = "const " + qualifier + "float " + name + " = " + formatGLSLFloat(parameter->value) + ";";
+                }
+            }
+            specialized += line;
+            specialized += '\n';
+        }
+        return specialized;
+    }
+
+    PendingProgram submitShaderFile(const std::string &path, const ParameterSettings &settings, ProgramCache &cache)
+    {
+        const std::string fileSource = loadFile(path);
+        std::vector<ShaderParameter> parameters = parseParameters(fileSource);
+        for (auto &parameter : parameters)
+        {
+            const auto value = settings.values.find(parameter.name);
+            if (value != settings.values.end())
+            {
+                parameter.value = value->second;
+            }
+            parameter.live = settings.live.count(parameter.name) > 0;
+        }
+
+        // Blanked before specializing: the define specializeParameters prepends would otherwise come first.
+        const std::string source = blankVersionDirective(fileSource);
+        PendingProgram pending = submitShaderProgram(
+            parameters.empty() ? source : specializeParameters(source, parameters), cache, path);
+        pending.parameters = std::move(parameters);
+        pending.textures = parseLookupTextures(fileSource, path);
+        return pending;
+    }
+
+    // Reads `NAME = VALUE` lines, as in RetroArch presets; `#` starts a comment and values may be quoted.
+    void loadParameterFile(const std::string &path, ParameterSettings &settings)
+    {
+        std::ifstream stream(path);
+        if (!stream)
+        {
+            throw std::runtime_error("Failed to open parameter file: " + path);
+        }
+
+        static const std::regex assignment(R"re(^\s*(\w+)\s*=\s*"?([^"\s]+)"?\s*$)re");
+        std::string line;
+        while (std::getline(stream, line))
+        {
+            line = line.substr(0, line.find('#'));
+            std::smatch match;
+            if (std::regex_match(line, match, assignment))
+            {
+                try
+                {
+                    settings.values[match[1].str()] = std::stof(match[2].str());
+                }
+                catch (const std::exception &)
+                {
+                    std::cerr << "Ignoring non-numeric parameter in " << path << ": " << line << "\n";
+                }
+            }
+        }
+    }
+
+    ScaleType parseScaleType(const std::string &value, const std::string &path)
+    {
+        if (value == "source")
+        {
+            return ScaleType::Source;
+        }
+        if (value == "viewport")
+        {
+            return ScaleType::Viewport;
+        }
+        if (value == "absolute")
+        {
+            return ScaleType::Absolute;
+        }
+        throw std::runtime_error("Unknown scale type in " + path + ": " + value);
+    }
+
+    // Reads a pass list in the spirit of RetroArch .glslp presets: `shaders = N`, then `shaderI`, `scale_typeI`
+    // (or `scale_type_xI`/`scale_type_yI`), `scaleI` (or `scale_xI`/`scale_yI`), `filter_linearI` and
+    // `float_framebufferI` per pass. `textures = "A;B"` names lookup textures, each with `A = FILE` and optional
+    // `A_linear`, `A_mipmap` and `A_wrap_mode`. Paths are relative to the preset; other numeric keys set
+    // parameters.
+    void loadPresetFile(const std::string &path, Options &options)
+    {
+        std::ifstream stream(path);
+        if (!stream)
+        {
+            throw std::runtime_error("Failed to open preset: " + path);
+        }
+
+        static const std::regex assignment(R"re(^\s*(\w+)\s*=\s*"?([^"]*?)"?\s*$)re");
+        static const std::regex passKey(R"re((shader|scale_type|scale_type_x|scale_type_y|scale|scale_x|scale_y|filter_linear|float_framebuffer)(\d+))re");
+        std::map<std::string, std::string> values;
+        std::string line;
+        while (std::getline(stream, line))
+        {
+            line = line.substr(0, line.find('#'));
+            std::smatch match;
+            if (std::regex_match(line, match, assignment))
+            {
+                values[match[1].str()] = match[2].str();
+            }
+        }
+
+        const auto count = values.find("shaders");
+        if (count == values.end())
+        {
+            throw std::runtime_error("Preset has no 'shaders' count: " + path);
+        }
+        std::vector<PassSettings> passes(static_cast<size_t>(std::max(0, std::stoi(count->second))));
+        const std::filesystem::path directory = std::filesystem::path(path).parent_path();
+
+        std::set<std::string> textureKeys;
+        const auto textures = values.find("textures");
+        if (textures != values.end())
+        {
+            std::string list = textures->second;
+            list.erase(std::remove_if(list.begin(), list.end(), [](unsigned char c) { return std::isspace(c); }),
+                       list.end());
+            std::istringstream names(list);
+            std::string name;
+            while (std::getline(names, name, ';'))
+            {
+                if (name.empty())
+                {
+                    continue;
+                }
+                const auto file = values.find(name);
+                if (file == values.end())
+                {
+                    throw std::runtime_error("Preset texture " + name + " has no file in " + path);
+                }
+                LookupTextureSpec texture;
+                texture.name = name;
+                texture.path = (directory / file->second).lexically_normal().string();
+                const auto linear = values.find(name + "_linear");
+                if (linear != values.end())
+                {
+                    texture.linear = linear->second == "true" || linear->second == "1";
+                }
+                const auto mipmap = values.find(name + "_mipmap");
+                if (mipmap != values.end())
+                {
+                    texture.mipmap = mipmap->second == "true" || mipmap->second == "1";
+                }
+                const auto wrap = values.find(name + "_wrap_mode");
+                if (wrap != values.end())
+                {
+                    texture.wrap = parseLookupWrap(wrap->second, path);
+                }
+                options.lookupTextures.push_back(texture);
+                textureKeys.insert({name, name + "_linear", name + "_mipmap", name + "_wrap_mode"});
+            }
+        }
+
+        for (const auto &[key, value] : values)
+        {
+            std::smatch match;
+            if (key == "shaders" || key == "parameters" || key == "textures" || textureKeys.count(key) > 0)
+            {
+                continue;
+            }
+            if (!std::regex_match(key, match, passKey))
+            {
+                try
+                {
+                    options.parameters.values[key] = std::stof(value);
+                }
+                catch (const std::exception &)
+                {
+                    std::cerr << "Ignoring preset key " << key << " in " << path << "\n";
+                }
+                continue;
+            }
+
+            const size_t index = std::stoul(match[2].str());
+            if (index >= passes.size())
+            {
+                throw std::runtime_error("Preset key " + key + " is beyond 'shaders' in " + path);
+            }
+            PassSettings &pass = passes[index];
+            const std::string field = match[1].str();
+            if (field == "shader")
+            {
+                pass.path = (directory / value).lexically_normal().string();
+            }
+            else if (field == "scale_type")
+            {
+                pass.scaleTypeX = pass.scaleTypeY = parseScaleType(value, path);
+            }
+            else if (field == "scale_type_x")
+            {
+                pass.scaleTypeX = parseScaleType(value, path);
+            }
+            else if (field == "scale_type_y")
+            {
+                pass.scaleTypeY = parseScaleType(value, path);
+            }
+            else if (field == "scale")
+            {
+                pass.scaleX = pass.scaleY = std::stof(value);
+            }
+            else if (field == "scale_x")
+            {
+                pass.scaleX = std::stof(value);
+            }
+            else if (field == "scale_y")
+            {
+                pass.scaleY = std::stof(value);
+            }
+            else if (field == "filter_linear")
+            {
+                pass.filterLinear = value == "true" || value == "1";
+            }
+            else
+            {
+                pass.floatFramebuffer = value == "true" || value == "1";
+            }
+        }
+
+        for (size_t i = 0; i < passes.size(); ++i)
+        {
+            if (passes[i].path.empty())
+            {
+                throw std::runtime_error("Preset is missing shader" + std::to_string(i) + ": " + path);
+            }
+        }
+        options.passes.insert(options.passes.end(), passes.begin(), passes.end());
+    }
+
+    GLuint buildFullscreenVAO()
+    {
+        std::array<float, 36> vertices = {
+            // positions      // tex coords
+            -1.0f, -1.0f, 0.0f, 1.0f, 0.0f, 0.0f,
+             1.0f, -1.0f, 0.0f, 1.0f, 1.0f, 0.0f,
+             1.0f,  1.0f, 0.0f, 1.0f, 1.0f, 1.0f,
+            -1.0f, -1.0f, 0.0f, 1.0f, 0.0f, 0.0f,
+             1.0f,  1.0f, 0.0f, 1.0f, 1.0f, 1.0f,
+            -1.0f,  1.0f, 0.0f, 1.0f, 0.0f, 1.0f,
+        };
+
+        GLuint vao = 0;
+        GLuint vbo = 0;
+        glGenVertexArrays(1, &vao);
+        glGenBuffers(1, &vbo);
+
+        glBindVertexArray(vao);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices.data(), GL_STATIC_DRAW);
+
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 6 * sizeof(float), reinterpret_cast<void *>(0));
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 6 * sizeof(float), reinterpret_cast<void *>(4 * sizeof(float)));
+
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        return vao;
+    }
+
+    // Throws when the driver cannot hold a texture of this size; callers check before allocating anything for it.
+    void checkTextureSize(int width, int height, const std::string &what)
+    {
+        GLint maxSize = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+        if (maxSize > 0 && (width > maxSize || height > maxSize))
+        {
+            throw std::runtime_error(what + " exceeds GL_MAX_TEXTURE_SIZE (" + std::to_string(maxSize) + ")");
+        }
+    }
+
+    GLuint createTexture(int width, int height, const std::vector<std::uint8_t> &initialData, GLenum internalFormat = GL_RGBA8)
+    {
+        GLuint texture = 0;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, static_cast<GLint>(internalFormat), width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                     initialData.empty() ? nullptr : initialData.data());
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return texture;
+    }
+
+    RenderTarget createRenderTarget(int width, int height, GLenum internalFormat = GL_RGBA8)
+    {
+        RenderTarget target;
+        target.width = width;
+        target.height = height;
+        target.format = internalFormat;
+        target.texture = createTexture(width, height, {}, internalFormat);
+        glGenFramebuffers(1, &target.framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, target.framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target.texture, 0);
+
+        const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+        if (status != GL_FRAMEBUFFER_COMPLETE)
+        {
+            throw std::runtime_error("Framebuffer incomplete");
+        }
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        return target;
+    }
+
+    size_t renderTargetBytes(const RenderTarget &target)
+    {
+        const size_t texelBytes = target.format == GL_RGBA16F ? 8 : 4;
+        return static_cast<size_t>(target.width) * static_cast<size_t>(target.height) * texelBytes;
+    }
+
+    // Render targets keyed by size and format. Released targets stay allocated for kPoolIdleFrames frames, so a
+    // size the pipeline returns to (a resize undone, a render scale stepping back) is reused instead of
+    // reallocated; after that they are deleted.
+    class RenderTargetPool
+    {
+    public:
+        static constexpr std::uint64_t kPoolIdleFrames = 120;
+
+        RenderTargetPool() = default;
+
+        ~RenderTargetPool()
+        {
+            clear();
+        }
+
+        RenderTargetPool(const RenderTargetPool &) = delete;
+        RenderTargetPool &operator=(const RenderTargetPool &) = delete;
+
+        RenderTarget acquire(int width, int height, GLenum format)
+        {
+            const auto match = std::find_if(idle_.begin(), idle_.end(), [&](const IdleTarget &idle) {
+                return idle.target.width == width && idle.target.height == height && idle.target.format == format;
+            });
+            RenderTarget target;
+            if (match != idle_.end())
+            {
+                target = match->target;
+                idle_.erase(match);
+            }
+            else
+            {
+                target = createRenderTarget(width, height, format);
+                allocatedBytes_ += renderTargetBytes(target);
+            }
+            inUse_++;
+            return target;
+        }
+
+        void release(RenderTarget &target)
+        {
+            if (!target.framebuffer)
+            {
+                return;
+            }
+            idle_.push_back(IdleTarget{target, frame_});
+            target = RenderTarget{};
+            inUse_--;
+        }
+
+        // Called once per frame; deletes targets that have sat unused for kPoolIdleFrames frames.
+        void endFrame()
+        {
+            frame_++;
+            for (auto idle = idle_.begin(); idle != idle_.end();)
+            {
+                if (frame_ - idle->releasedAt < kPoolIdleFrames)
+                {
+                    ++idle;
+                    continue;
+                }
+                allocatedBytes_ -= renderTargetBytes(idle->target);
+                destroyRenderTarget(idle->target);
+                idle = idle_.erase(idle);
+            }
+        }
+
+        // Deletes every idle target. Targets still held are left alone.
+        void clear()
+        {
+            for (auto &idle : idle_)
+            {
+                allocatedBytes_ -= renderTargetBytes(idle.target);
+                destroyRenderTarget(idle.target);
+            }
+            idle_.clear();
+        }
+
+        // Texture memory of every target the pool has allocated, in use or idle.
+        size_t allocatedBytes() const
+        {
+            return allocatedBytes_;
+        }
+
+        size_t targetCount() const
+        {
+            return inUse_ + idle_.size();
+        }
+
+    private:
+        struct IdleTarget
+        {
+            RenderTarget target;
+            std::uint64_t releasedAt = 0;
+        };
+
+        std::vector<IdleTarget> idle_;
+        size_t inUse_ = 0;
+        size_t allocatedBytes_ = 0;
+        std::uint64_t frame_ = 0;
+    };
+
+    // Holds one target from a RenderTargetPool and hands it back when destroyed, reset or resized.
+    class PooledTarget
+    {
+    public:
+        PooledTarget() = default;
+
+        ~PooledTarget()
+        {
+            reset();
+        }
+
+        PooledTarget(PooledTarget &&other) noexcept : pool_(other.pool_), target_(other.target_)
+        {
+            other.target_ = RenderTarget{};
+        }
+
+        PooledTarget &operator=(PooledTarget &&other) noexcept
+        {
+            if (this != &other)
+            {
+                reset();
+                pool_ = other.pool_;
+                target_ = other.target_;
+                other.target_ = RenderTarget{};
+            }
+            return *this;
+        }
+
+        PooledTarget(const PooledTarget &) = delete;
+        PooledTarget &operator=(const PooledTarget &) = delete;
+
+        // Makes this hold a target of the given size and format; a matching one is kept as is.
+        void ensure(RenderTargetPool &pool, int width, int height, GLenum format = GL_RGBA8)
+        {
+            if (target_.framebuffer && target_.width == width && target_.height == height && target_.format == format)
+            {
+                return;
+            }
+            reset();
+            pool_ = &pool;
+            target_ = pool.acquire(width, height, format);
+        }
+
+        void reset()
+        {
+            if (pool_)
+            {
+                pool_->release(target_);
+            }
+        }
+
+        const RenderTarget &get() const
+        {
+            return target_;
+        }
+
+    private:
+        RenderTargetPool *pool_ = nullptr;
+        RenderTarget target_;
+    };
+
+    void clearRenderTarget(const RenderTarget &target)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, target.framebuffer);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    // Makes `target` hold a target of the given size and format; a newly acquired one is cleared so history read
+    // from it before anything was drawn is black rather than whatever the pool last held there.
+    void ensureClearedTarget(PooledTarget &target, RenderTargetPool &pool, int width, int height, GLenum format)
+    {
+        const GLuint previous = target.get().texture;
+        target.ensure(pool, width, height, format);
+        if (target.get().texture != previous)
+        {
+            clearRenderTarget(target.get());
+        }
+    }
+
+    // Recent input frames for shaders that sample PrevTexture..Prev6Texture. The source draws each new frame
+    // straight into the next slot, so the frame that was current simply becomes PrevTexture; nothing is copied.
+    struct InputHistory
+    {
+        std::vector<PooledTarget> frames;
+        size_t head = 0;
+    };
+
+    // How many previous input frames the pipeline samples: 1 for PrevTexture up to 7 for Prev6Texture.
+    size_t inputHistoryDepth(const std::vector<ShaderProgram> &pipeline)
+    {
+        size_t depth = 0;
+        for (const auto &program : pipeline)
+        {
+            for (size_t age = 0; age < kHistoryFrames; ++age)
+            {
+                if (program.historyUnits[age] > 0)
+                {
+                    depth = std::max(depth, age + 1);
+                }
+            }
+        }
+        return depth;
+    }
+
+    // Rotates the ring and returns the slot the new input frame has to be drawn into.
+    const RenderTarget &advanceInputHistory(InputHistory &history, RenderTargetPool &pool, size_t depth, int width,
+                                            int height, GLenum format)
+    {
+        history.frames.resize(depth + 1);
+        history.head = (history.head + 1) % history.frames.size();
+        for (auto &frame : history.frames)
+        {
+            ensureClearedTarget(frame, pool, width, height, format);
+        }
+        return history.frames[history.head].get();
+    }
+
+    // The input frame `age` frames back, 0 being the current one.
+    GLuint inputHistoryTexture(const InputHistory &history, size_t age)
+    {
+        const size_t count = history.frames.size();
+        return history.frames[(history.head + count - age % count) % count].get().texture;
+    }
+
+    std::vector<std::uint8_t> buildTestPattern(int width, int height)
+    {
+        std::vector<std::uint8_t> data(static_cast<size_t>(width * height * 4));
+        for (int y = 0; y < height; ++y)
+        {
+            for (int x = 0; x < width; ++x)
+            {
+                const float xf = static_cast<float>(x) / static_cast<float>(width);
+                const float yf = static_cast<float>(y) / static_cast<float>(height);
+                const size_t idx = static_cast<size_t>((y * width + x) * 4);
+                data[idx + 0] = static_cast<std::uint8_t>(255.0f * xf);
+                data[idx + 1] = static_cast<std::uint8_t>(255.0f * (1.0f - xf));
+                data[idx + 2] = static_cast<std::uint8_t>(255.0f * yf);
+                data[idx + 3] = 255;
+            }
+        }
+        return data;
+    }
+
+    int maskShift(unsigned long mask)
+    {
+        if (mask == 0)
+        {
+            return 0;
+        }
+        int shift = 0;
+        while ((mask & 1u) == 0u)
+        {
+            mask >>= 1;
+            ++shift;
+        }
+        return shift;
+    }
+
+    int maskSize(unsigned long mask)
+    {
+        int size = 0;
+        while (mask)
+        {
+            size += static_cast<int>(mask & 1u);
+            mask >>= 1;
+        }
+        return size;
+    }
+
+#if CRT_HAS_XDAMAGE
+    // Merges the cheapest pair (least added area) until at most maxRects remain.
+    void coalesceRects(std::vector<CaptureRect> &rects, size_t maxRects)
+    {
+        const auto unite = [](const CaptureRect &a, const CaptureRect &b) {
+            CaptureRect merged;
+            merged.x = std::min(a.x, b.x);
+            merged.y = std::min(a.y, b.y);
+            merged.width = std::max(a.x + a.width, b.x + b.width) - merged.x;
+            merged.height = std::max(a.y + a.height, b.y + b.height) - merged.y;
+            return merged;
+        };
+        const auto area = [](const CaptureRect &rect) {
+            return static_cast<long long>(rect.width) * static_cast<long long>(rect.height);
+        };
+
+        // Pairwise merging is cubic; very fragmented regions collapse straight to their bounding box.
+        if (rects.size() > 256)
+        {
+            CaptureRect bounds = rects.front();
+            for (const auto &rect : rects)
+            {
+                bounds = unite(bounds, rect);
+            }
+            rects.assign(1, bounds);
+        }
+
+        while (rects.size() > maxRects)
+        {
+            size_t bestA = 0;
+            size_t bestB = 1;
+            long long bestCost = -1;
+            for (size_t a = 0; a < rects.size(); ++a)
+            {
+                for (size_t b = a + 1; b < rects.size(); ++b)
+                {
+                    const long long cost = area(unite(rects[a], rects[b])) - area(rects[a]) - area(rects[b]);
+                    if (bestCost < 0 || cost < bestCost)
+                    {
+                        bestCost = cost;
+                        bestA = a;
+                        bestB = b;
+                    }
+                }
+            }
+            rects[bestA] = unite(rects[bestA], rects[bestB]);
+            rects.erase(rects.begin() + static_cast<std::ptrdiff_t>(bestB));
+        }
+    }
+#endif
+
+#if CRT_HAS_X11
+    // One capture image per triple-buffer slot, so the producer never overwrites pixels the consumer still reads.
+    struct CaptureImage
+    {
+        XImage *image = nullptr;
+#if CRT_HAS_XSHM
+        XShmSegmentInfo shmInfo{};
+        bool shmAttached = false;
+#endif
+    };
+
+    class ScreenCapture
+    {
+    public:
+        static constexpr size_t kImageCount = 3;
+
+        explicit ScreenCapture(const CaptureSettings &settings)
+            : monitor_(settings.monitor), monitorIndex_(settings.monitorIndex), windowRegion_(settings.windowRegion)
+        {
+            display_ = XOpenDisplay(nullptr);
+            if (!display_)
+            {
+                return;
+            }
+
+            root_ = DefaultRootWindow(display_);
+            XWindowAttributes attrs;
+            if (XGetWindowAttributes(display_, root_, &attrs) != 0)
+            {
+                visual_ = attrs.visual;
+                depth_ = attrs.depth;
+                rootWidth_ = attrs.width;
+                rootHeight_ = attrs.height;
+            }
+#if CRT_HAS_XSHM
+            useShm_ = XShmQueryExtension(display_) == True;
+#endif
+#if CRT_HAS_XDAMAGE
+            int damageErrorBase = 0;
+            int fixesEventBase = 0;
+            int fixesErrorBase = 0;
+            if (settings.trackDamage && XDamageQueryExtension(display_, &damageEventBase_, &damageErrorBase) &&
+                XFixesQueryExtension(display_, &fixesEventBase, &fixesErrorBase))
+            {
+                int major = 1;
+                int minor = 1;
+                XDamageQueryVersion(display_, &major, &minor);
+                major = 2;
+                minor = 0;
+                XFixesQueryVersion(display_, &major, &minor);
+
+                damage_ = XDamageCreate(display_, root_, XDamageReportNonEmpty);
+                damageRegion_ = XFixesCreateRegion(display_, nullptr, 0);
+                // Root resizes arrive as ConfigureNotify, so the root geometry is no longer polled every frame.
+                XSelectInput(display_, root_, StructureNotifyMask);
+                useDamage_ = true;
+            }
+#endif
+#if CRT_HAS_XRANDR
+            int randrErrorBase = 0;
+            int major = 0;
+            int minor = 0;
+            if (!monitor_.empty() && XRRQueryExtension(display_, &randrEventBase_, &randrErrorBase) &&
+                XRRQueryVersion(display_, &major, &minor) && (major > 1 || (major == 1 && minor >= 3)))
+            {
+                // Hotplug and mode changes arrive as events, so the monitor layout is never polled.
+                XRRSelectInput(display_, root_, RRScreenChangeNotifyMask | RRCrtcChangeNotifyMask |
+                                                    RROutputChangeNotifyMask);
+                XSelectInput(display_, root_, StructureNotifyMask);
+                useRandr_ = true;
+                loadMonitors();
+            }
+#endif
+            if (!monitor_.empty() && !useRandr_)
+            {
+                std::cerr << "--monitor needs XRandR 1.3; capturing the whole screen\n";
+            }
+        }
+
+        ~ScreenCapture()
+        {
+            for (auto &image : images_)
+            {
+                releaseImage(image);
+            }
+            if (display_)
+            {
+#if CRT_HAS_XDAMAGE
+                if (useDamage_)
+                {
+                    XFixesDestroyRegion(display_, damageRegion_);
+                    XDamageDestroy(display_, damage_);
+                }
+#endif
+                XCloseDisplay(display_);
+            }
+        }
+
+        ScreenCapture(const ScreenCapture &) = delete;
+        ScreenCapture &operator=(const ScreenCapture &) = delete;
+
+        const char *backendName() const
+        {
+            if (!display_)
+            {
+                return "unavailable";
+            }
+            if (useShm_)
+            {
+                return useDamage_ ? "MIT-SHM + XDamage" : "MIT-SHM";
+            }
+            return useDamage_ ? "XGetImage + XDamage" : "XGetImage";
+        }
+
+        bool tracksDamage() const
+        {
+            return useDamage_;
+        }
+
+        // Blocks until the X connection has input or the timeout expires.
+        void waitForEvents(std::chrono::milliseconds timeout)
+        {
+            if (!display_ || XPending(display_) > 0)
+            {
+                return;
+            }
+            pollfd descriptor{};
+            descriptor.fd = ConnectionNumber(display_);
+            descriptor.events = POLLIN;
+            poll(&descriptor, 1, static_cast<int>(timeout.count()));
+        }
+
+        // Captures `region` (the whole root when empty) into images_[imageIndex]. The returned rects are relative
+        // to the region, point into that image and stay valid until it is grabbed into again. Rects in `forced` are
+        // refetched even if they were not damaged again. An empty rect list means nothing changed since the
+        // previous grab.
+        bool grab(CaptureFrame &frame, size_t imageIndex, const std::vector<CaptureRect> &forced,
+                  const CaptureRegion &region)
+        {
+            frame.rects.clear();
+            frame.damagedPixels = 0;
+            frame.backend = backendName();
+            if (!display_)
+            {
+                return false;
+            }
+
+            CaptureImage &target = images_[imageIndex];
+            if (useDamage_ || useRandr_)
+            {
+                pollEvents();
+            }
+            else
+            {
+                XWindowAttributes attrs;
+                if (XGetWindowAttributes(display_, root_, &attrs) == 0)
+                {
+                    return false;
+                }
+                rootWidth_ = attrs.width;
+                rootHeight_ = attrs.height;
+            }
+            applyRegion(region);
+
+            const bool fullFrame = !useDamage_ || needFullFrame_ || !format_;
+            if (!fullFrame && !damagePending_ && forced.empty())
+            {
+                describeFormat(frame);
+                return true;
+            }
+
+            if (!fullFrame)
+            {
+                std::vector<CaptureRect> damaged = fetchDamage(forced);
+                if (damaged.empty())
+                {
+                    describeFormat(frame);
+                    return true;
+                }
+
+                long long damagedArea = 0;
+                for (const auto &rect : damaged)
+                {
+                    damagedArea += static_cast<long long>(rect.width) * static_cast<long long>(rect.height);
+                }
+                // One full round trip beats many partial ones once most of the screen changed.
+                const long long screenArea = static_cast<long long>(width_) * static_cast<long long>(height_);
+                if (useShm_ && damagedArea * 2 <= screenArea && fetchRects(target, damaged))
+                {
+                    frame.rects = std::move(damaged);
+                    frame.damagedPixels = static_cast<std::uint64_t>(damagedArea);
+                    describeFormat(frame);
+                    return true;
+                }
+            }
+            else
+            {
+                discardDamage();
+            }
+
+            if (!fetchImage(target, width_, height_))
+            {
+                return false;
+            }
+            if (target.image->bits_per_pixel != 32 && target.image->bits_per_pixel != 24)
+            {
+                releaseImage(target);
+                return false;
+            }
+            needFullFrame_ = false;
+            format_ = target.image;
+
+            CaptureRect full;
+            full.width = width_;
+            full.height = height_;
+            full.data = reinterpret_cast<const std::uint8_t *>(target.image->data);
+            full.bytesPerLine = target.image->bytes_per_line;
+            frame.rects.push_back(full);
+            frame.damagedPixels = static_cast<std::uint64_t>(width_) * static_cast<std::uint64_t>(height_);
+            describeFormat(frame);
+            return true;
+        }
+
+    private:
+        static constexpr size_t kMaxDamageRects = 8;
+
+        void describeFormat(CaptureFrame &frame) const
+        {
+            frame.originX = regionX_;
+            frame.originY = regionY_;
+            frame.width = width_;
+            frame.height = height_;
+            frame.bitsPerPixel = format_->bits_per_pixel;
+            frame.redMask = format_->red_mask;
+            frame.greenMask = format_->green_mask;
+            frame.blueMask = format_->blue_mask;
+            frame.msbFirst = format_->byte_order == MSBFirst;
+        }
+
+        // Keeps the region inside the root, or the selected monitor, by shifting it rather than clipping, so
+        // moving the window along a screen edge never changes the capture size.
+        void applyRegion(const CaptureRegion &region)
+        {
+            const CaptureRegion bounds = captureBounds(region);
+            int x = bounds.x;
+            int y = bounds.y;
+            int width = bounds.width;
+            int height = bounds.height;
+            if (windowRegion_ && region.width > 0 && region.height > 0)
+            {
+                width = std::min(region.width, bounds.width);
+                height = std::min(region.height, bounds.height);
+                x = std::clamp(region.x, bounds.x, bounds.x + bounds.width - width);
+                y = std::clamp(region.y, bounds.y, bounds.y + bounds.height - height);
+            }
+
+            if (x != regionX_ || y != regionY_ || width != width_ || height != height_)
+            {
+                regionX_ = x;
+                regionY_ = y;
+                width_ = width;
+                height_ = height;
+                needFullFrame_ = true;
+            }
+        }
+
+        // The area capture is limited to: the monitor selected by --monitor, or the whole root.
+        CaptureRegion captureBounds(const CaptureRegion &region)
+        {
+            const CaptureRegion root{0, 0, rootWidth_, rootHeight_};
+            if (monitors_.empty())
+            {
+                return root;
+            }
+
+            const Monitor *selected = nullptr;
+            if (monitor_ == "auto")
+            {
+                // The monitor under the window's center, so a window straddling two outputs picks one.
+                const int centerX = region.x + region.width / 2;
+                const int centerY = region.y + region.height / 2;
+                for (const auto &monitor : monitors_)
+                {
+                    const CaptureRegion &area = monitor.bounds;
+                    if (region.width > 0 && centerX >= area.x && centerX < area.x + area.width && centerY >= area.y &&
+                        centerY < area.y + area.height)
+                    {
+                        selected = &monitor;
+                        break;
+                    }
+                }
+                if (!selected)
+                {
+                    const auto primary = std::find_if(monitors_.begin(), monitors_.end(),
+                                                      [](const Monitor &monitor) { return monitor.primary; });
+                    selected = primary != monitors_.end() ? &*primary : &monitors_.front();
+                }
+            }
+            else if (monitorIndex_ >= 0)
+            {
+                const auto index = static_cast<size_t>(monitorIndex_);
+                selected = index < monitors_.size() ? &monitors_[index] : nullptr;
+            }
+            else
+            {
+                const auto named = std::find_if(monitors_.begin(), monitors_.end(),
+                                                [this](const Monitor &monitor) { return monitor.name == monitor_; });
+                selected = named != monitors_.end() ? &*named : nullptr;
+            }
+
+            const std::string description =
+                selected ? selected->name + " (" + std::to_string(selected->bounds.width) + "x" +
+                               std::to_string(selected->bounds.height) + "+" + std::to_string(selected->bounds.x) +
+                               "+" + std::to_string(selected->bounds.y) + ")"
+                         : std::string();
+            if (description != reportedMonitor_)
+            {
+                if (selected)
+                {
+                    std::cerr << "Capturing monitor " << description << "\n";
+                }
+                else
+                {
+                    std::cerr << "Monitor " << monitor_ << " not found; capturing the whole screen\n";
+                }
+                reportedMonitor_ = description;
+            }
+            if (!selected)
+            {
+                return root;
+            }
+
+            // A CRTC can briefly extend past the root while the screen is being resized.
+            const int left = std::clamp(selected->bounds.x, 0, rootWidth_);
+            const int top = std::clamp(selected->bounds.y, 0, rootHeight_);
+            const int right = std::clamp(selected->bounds.x + selected->bounds.width, left, rootWidth_);
+            const int bottom = std::clamp(selected->bounds.y + selected->bounds.height, top, rootHeight_);
+            if (right == left || bottom == top)
+            {
+                return root;
+            }
+            return CaptureRegion{left, top, right - left, bottom - top};
+        }
+
+        // Lists the active CRTCs, ordered left to right and top to bottom so --monitor=N counts across the desk.
+        void loadMonitors()
+        {
+            monitors_.clear();
+#if CRT_HAS_XRANDR
+            XRRScreenResources *resources = XRRGetScreenResourcesCurrent(display_, root_);
+            if (!resources)
+            {
+                return;
+            }
+            const RROutput primary = XRRGetOutputPrimary(display_, root_);
+            for (int i = 0; i < resources->ncrtc; ++i)
+            {
+                XRRCrtcInfo *crtc = XRRGetCrtcInfo(display_, resources, resources->crtcs[i]);
+                if (!crtc)
+                {
+                    continue;
+                }
+                if (crtc->mode != None && crtc->noutput > 0 && crtc->width > 0 && crtc->height > 0)
+                {
+                    Monitor monitor;
+                    monitor.bounds = CaptureRegion{crtc->x, crtc->y, static_cast<int>(crtc->width),
+                                                   static_cast<int>(crtc->height)};
+                    monitor.primary = std::find(crtc->outputs, crtc->outputs + crtc->noutput, primary) !=
+                                      crtc->outputs + crtc->noutput;
+                    if (XRROutputInfo *output = XRRGetOutputInfo(display_, resources, crtc->outputs[0]))
+                    {
+                        monitor.name.assign(output->name, static_cast<size_t>(output->nameLen));
+                        XRRFreeOutputInfo(output);
+                    }
+                    monitors_.push_back(std::move(monitor));
+                }
+                XRRFreeCrtcInfo(crtc);
+            }
+            XRRFreeScreenResources(resources);
+#endif
+            std::sort(monitors_.begin(), monitors_.end(), [](const Monitor &a, const Monitor &b) {
+                return a.bounds.x != b.bounds.x ? a.bounds.x < b.bounds.x : a.bounds.y < b.bounds.y;
+            });
+        }
+
+        void pollEvents()
+        {
+            bool monitorsChanged = false;
+            while (XPending(display_) > 0)
+            {
+                XEvent event;
+                XNextEvent(display_, &event);
+#if CRT_HAS_XRANDR
+                if (useRandr_ && (event.type == randrEventBase_ + RRScreenChangeNotify ||
+                                  event.type == randrEventBase_ + RRNotify))
+                {
+                    XRRUpdateConfiguration(&event);
+                    monitorsChanged = true;
+                    continue;
+                }
+#endif
+#if CRT_HAS_XDAMAGE
+                if (event.type == damageEventBase_ + XDamageNotify)
+                {
+                    damagePending_ = true;
+                    continue;
+                }
+#endif
+                if (event.type == ConfigureNotify && event.xconfigure.window == root_ &&
+                    (event.xconfigure.width != rootWidth_ || event.xconfigure.height != rootHeight_))
+                {
+                    rootWidth_ = event.xconfigure.width;
+                    rootHeight_ = event.xconfigure.height;
+                    needFullFrame_ = true;
+                }
+            }
+            if (monitorsChanged)
+            {
+                loadMonitors();
+            }
+        }
+
+        std::vector<CaptureRect> fetchDamage(const std::vector<CaptureRect> &forced)
+        {
+            std::vector<CaptureRect> rects;
+#if CRT_HAS_XDAMAGE
+            if (damagePending_)
+            {
+                XDamageSubtract(display_, damage_, None, damageRegion_);
+                int count = 0;
+                XRectangle *parts = XFixesFetchRegion(display_, damageRegion_, &count);
+                for (int i = 0; i < count; ++i)
+                {
+                    CaptureRect rect;
+                    rect.x = std::max(0, parts[i].x - regionX_);
+                    rect.y = std::max(0, parts[i].y - regionY_);
+                    rect.width = std::min(width_, parts[i].x - regionX_ + static_cast<int>(parts[i].width)) - rect.x;
+                    rect.height = std::min(height_, parts[i].y - regionY_ + static_cast<int>(parts[i].height)) - rect.y;
+                    if (rect.width > 0 && rect.height > 0)
+                    {
+                        rects.push_back(rect);
+                    }
+                }
+                if (parts)
+                {
+                    XFree(parts);
+                }
+            }
+            for (const auto &rect : forced)
+            {
+                CaptureRect clipped = rect;
+                clipped.width = std::min(width_, rect.x + rect.width) - rect.x;
+                clipped.height = std::min(height_, rect.y + rect.height) - rect.y;
+                if (clipped.width > 0 && clipped.height > 0)
+                {
+                    rects.push_back(clipped);
+                }
+            }
+            coalesceRects(rects, kMaxDamageRects);
+#else
+            (void)forced;
+#endif
+            damagePending_ = false;
+            return rects;
+        }
+
+        void discardDamage()
+        {
+            damagePending_ = false;
+#if CRT_HAS_XDAMAGE
+            if (useDamage_)
+            {
+                XDamageSubtract(display_, damage_, None, None);
+            }
+#endif
+        }
+
+        // Packs every damaged rect back to back into the shared segment, one XShmGetImage per rect.
+        bool fetchRects(CaptureImage &target, std::vector<CaptureRect> &rects)
+        {
+#if CRT_HAS_XSHM
+            if (!target.image || target.image->width != width_ || target.image->height != height_)
+            {
+                releaseImage(target);
+                if (!createShmImage(target, width_, height_))
+                {
+                    return false;
+                }
+            }
+            if (!target.shmAttached)
+            {
+                return false;
+            }
+
+            const size_t capacity = static_cast<size_t>(target.image->bytes_per_line) *
+                                    static_cast<size_t>(target.image->height);
+            size_t offset = 0;
+            for (auto &rect : rects)
+            {
+                XImage *part = XShmCreateImage(display_, visual_, static_cast<unsigned int>(depth_), ZPixmap,
+                                               target.shmInfo.shmaddr + offset, &target.shmInfo,
+                                               static_cast<unsigned int>(rect.width),
+                                               static_cast<unsigned int>(rect.height));
+                if (!part)
+                {
+                    return false;
+                }
+
+                const size_t size = static_cast<size_t>(part->bytes_per_line) * static_cast<size_t>(rect.height);
+                const bool fetched = offset + size <= capacity &&
+                                     XShmGetImage(display_, root_, part, regionX_ + rect.x, regionY_ + rect.y, AllPlanes);
+                rect.data = reinterpret_cast<const std::uint8_t *>(part->data);
+                rect.bytesPerLine = part->bytes_per_line;
+                part->data = nullptr;
+                XDestroyImage(part);
+                if (!fetched)
+                {
+                    return false;
+                }
+                offset += size;
+            }
+            return true;
+#else
+            (void)target;
+            (void)rects;
+            return false;
+#endif
+        }
+
+        bool fetchImage(CaptureImage &target, int width, int height)
+        {
+#if CRT_HAS_XSHM
+            if (useShm_)
+            {
+                if (!target.image || target.image->width != width || target.image->height != height)
+                {
+                    releaseImage(target);
+                    if (!createShmImage(target, width, height))
+                    {
+                        std::cerr << "MIT-SHM capture unavailable, falling back to XGetImage\n";
+                        useShm_ = false;
+                    }
+                }
+
+                if (useShm_)
+                {
+                    if (XShmGetImage(display_, root_, target.image, regionX_, regionY_, AllPlanes))
+                    {
+                        return true;
+                    }
+                    std::cerr << "XShmGetImage failed, falling back to XGetImage\n";
+                    releaseImage(target);
+                    useShm_ = false;
+                }
+            }
+#endif
+
+            releaseImage(target);
+            target.image = XGetImage(display_, root_, regionX_, regionY_, static_cast<unsigned int>(width),
+                                     static_cast<unsigned int>(height), AllPlanes, ZPixmap);
+            return target.image != nullptr;
+        }
+
+#if CRT_HAS_XSHM
+        static int recordShmError(Display *, XErrorEvent *)
+        {
+            shmAttachFailed_ = true;
+            return 0;
+        }
+
+        bool createShmImage(CaptureImage &target, int width, int height)
+        {
+            XShmSegmentInfo &shmInfo = target.shmInfo;
+            target.image = XShmCreateImage(display_, visual_, static_cast<unsigned int>(depth_), ZPixmap, nullptr,
+                                           &shmInfo, static_cast<unsigned int>(width), static_cast<unsigned int>(height));
+            if (!target.image)
+            {
+                return false;
+            }
+
+            shmInfo.shmid = shmget(IPC_PRIVATE, static_cast<size_t>(target.image->bytes_per_line * target.image->height),
+                                   IPC_CREAT | 0600);
+            if (shmInfo.shmid < 0)
+            {
+                releaseImage(target);
+                return false;
+            }
+
+            shmInfo.shmaddr = static_cast<char *>(shmat(shmInfo.shmid, nullptr, 0));
+            if (shmInfo.shmaddr == reinterpret_cast<char *>(-1))
+            {
+                shmctl(shmInfo.shmid, IPC_RMID, nullptr);
+                shmInfo.shmaddr = nullptr;
+                releaseImage(target);
+                return false;
+            }
+            target.image->data = shmInfo.shmaddr;
+            shmInfo.readOnly = False;
+
+            // Attaching fails asynchronously (e.g. on remote displays), so trap the error instead of aborting.
+            shmAttachFailed_ = false;
+            XErrorHandler previous = XSetErrorHandler(recordShmError);
+            const Bool attached = XShmAttach(display_, &shmInfo);
+            XSync(display_, False);
+            XSetErrorHandler(previous);
+
+            // Mark the segment for removal now so it is reclaimed even if the process dies.
+            shmctl(shmInfo.shmid, IPC_RMID, nullptr);
+
+            if (!attached || shmAttachFailed_)
+            {
+                releaseImage(target);
+                return false;
+            }
+            target.shmAttached = true;
+            return true;
+        }
+#endif
+
+        void releaseImage(CaptureImage &target)
+        {
+            if (!target.image)
+            {
+                return;
+            }
+            if (format_ == target.image)
+            {
+                format_ = nullptr;
+                needFullFrame_ = true;
+            }
+
+#if CRT_HAS_XSHM
+            if (target.shmInfo.shmaddr)
+            {
+                if (target.shmAttached)
+                {
+                    XShmDetach(display_, &target.shmInfo);
+                    XSync(display_, False);
+                    target.shmAttached = false;
+                }
+                shmdt(target.shmInfo.shmaddr);
+                target.shmInfo.shmaddr = nullptr;
+                target.image->data = nullptr;
+            }
+#endif
+            XDestroyImage(target.image);
+            target.image = nullptr;
+        }
+
+        Display *display_ = nullptr;
+        Window root_ = 0;
+        Visual *visual_ = nullptr;
+        int depth_ = 0;
+        int rootWidth_ = 0;
+        int rootHeight_ = 0;
+        // Captured region in root coordinates.
+        int regionX_ = 0;
+        int regionY_ = 0;
+        int width_ = 0;
+        int height_ = 0;
+        std::array<CaptureImage, kImageCount> images_{};
+        // The image the pixel format was last read from; every image shares the root visual.
+        const XImage *format_ = nullptr;
+        bool useShm_ = false;
+        bool useDamage_ = false;
+        bool useRandr_ = false;
+        bool damagePending_ = false;
+        bool needFullFrame_ = true;
+#if CRT_HAS_XDAMAGE
+        int damageEventBase_ = 0;
+        Damage damage_ = 0;
+        XserverRegion damageRegion_ = 0;
+#endif
+#if CRT_HAS_XRANDR
+        int randrEventBase_ = 0;
+#endif
+        // An active RandR output's area of the root window.
+        struct Monitor
+        {
+            std::string name;
+            CaptureRegion bounds;
+            bool primary = false;
+        };
+        const std::string monitor_;
+        const int monitorIndex_;
+        const bool windowRegion_;
+        std::vector<Monitor> monitors_;
+        // The monitor last announced on stderr, so changes are reported once.
+        std::string reportedMonitor_;
+#if CRT_HAS_XSHM
+        static inline bool shmAttachFailed_ = false;
+#endif
+    };
+#else
+    class ScreenCapture
+    {
+    public:
+        static constexpr size_t kImageCount = 3;
+
+        explicit ScreenCapture(const CaptureSettings &)
+        {
+        }
+
+        const char *backendName() const
+        {
+            return "unavailable";
+        }
+
+        bool tracksDamage() const
+        {
+            return false;
+        }
+
+        void waitForEvents(std::chrono::milliseconds timeout)
+        {
+            std::this_thread::sleep_for(timeout);
+        }
+
+        bool grab(CaptureFrame &frame, size_t, const std::vector<CaptureRect> &, const CaptureRegion &)
+        {
+            frame.backend = backendName();
+            return false;
+        }
+    };
+#endif
+
+    // Single-producer/single-consumer triple buffer. The producer always owns a slot to write into, the consumer
+    // always reads the newest published slot, and neither side ever waits for the other.
+    template <typename T>
+    class TripleBuffer
+    {
+    public:
+        T &back()
+        {
+            return slots_[back_];
+        }
+
+        size_t backIndex() const
+        {
+            return back_;
+        }
+
+        // True while the last published slot has not been picked up by the consumer.
+        bool pending() const
+        {
+            return (middle_.load(std::memory_order_acquire) & kFresh) != 0;
+        }
+
+        // Publishes back() and returns true when the slot it replaces was never consumed.
+        bool publish()
+        {
+            const std::uint8_t previous =
+                middle_.exchange(static_cast<std::uint8_t>(back_ | kFresh), std::memory_order_acq_rel);
+            back_ = previous & kIndexMask;
+            return (previous & kFresh) != 0;
+        }
+
+        // Swaps in the newest published slot, if any; front() stays untouched by the producer until the next call.
+        bool acquire()
+        {
+            if (!pending())
+            {
+                return false;
+            }
+            front_ = middle_.exchange(front_, std::memory_order_acq_rel) & kIndexMask;
+            return true;
+        }
+
+        const T &front() const
+        {
+            return slots_[front_];
+        }
+
+    private:
+        static constexpr std::uint8_t kIndexMask = 0x3;
+        static constexpr std::uint8_t kFresh = 0x4;
+
+        std::array<T, 3> slots_{};
+        std::uint8_t back_ = 0;
+        std::uint8_t front_ = 1;
+        std::atomic<std::uint8_t> middle_{2};
+    };
+
+    struct CaptureSlot
+    {
+        CaptureFrame frame;
+        bool captured = false;
+        std::chrono::steady_clock::time_point capturedAt;
+        std::chrono::steady_clock::duration grabTime{};
+    };
+
+    // Sleeps until `deadline` without spinning. On Linux this is an absolute CLOCK_MONOTONIC sleep (the clock
+    // behind steady_clock), which does not drift when the thread wakes late.
+    void preciseSleepUntil(std::chrono::steady_clock::time_point deadline)
+    {
+#if defined(__linux__)
+        const auto nanoseconds =
+            std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch()).count();
+        timespec target{};
+        target.tv_sec = static_cast<time_t>(nanoseconds / 1000000000);
+        target.tv_nsec = static_cast<long>(nanoseconds % 1000000000);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &target, nullptr) == EINTR)
+        {
+        }
+#else
+        std::this_thread::sleep_until(deadline);
+#endif
+    }
+
+    // Linux rounds sleeps up by the thread's timer slack (50 us by default); frame pacing wants it tight.
+    void reduceTimerSlack()
+    {
+#if defined(__linux__)
+        prctl(PR_SET_TIMERSLACK, 1000UL, 0UL, 0UL, 0UL);
+#endif
+    }
+
+    // Runs ScreenCapture on its own thread and X connection and hands finished frames to the render loop.
+    class CaptureThread
+    {
+    public:
+        // minInterval caps the capture rate below the render rate; zero captures once per displayed frame.
+        CaptureThread(const CaptureSettings &settings, std::chrono::nanoseconds minInterval)
+            : minInterval_(minInterval), thread_([this, settings] { run(settings); })
+        {
+        }
+
+        ~CaptureThread()
+        {
+            stop_.store(true);
+            thread_.join();
+        }
+
+        CaptureThread(const CaptureThread &) = delete;
+        CaptureThread &operator=(const CaptureThread &) = delete;
+
+        // Returns the newest published frame, or nullptr when the render loop should keep the previous one.
+        // frameInterval is the render loop's current frame time; it paces capture and classifies late frames.
+        const CaptureSlot *acquire(std::chrono::steady_clock::duration frameInterval)
+        {
+            renderInterval_.store(std::chrono::duration_cast<std::chrono::nanoseconds>(frameInterval).count(),
+                                  std::memory_order_relaxed);
+            if (!frames_.acquire())
+            {
+                reusedFrames++;
+                return nullptr;
+            }
+
+            const CaptureSlot &slot = frames_.front();
+            if (std::chrono::steady_clock::now() - slot.capturedAt > frameInterval)
+            {
+                lateFrames++;
+            }
+            return &slot;
+        }
+
+        // Called by the render loop; the capture thread picks the region up on its next grab.
+        void setRegion(const CaptureRegion &region)
+        {
+            region_.store(packRegion(region), std::memory_order_relaxed);
+        }
+
+        // Asks for `area` (frame coordinates) to be fetched again even if it is not damaged. Requests made before
+        // the capture thread gets to them merge into their bounding box.
+        void refresh(const CaptureRegion &area)
+        {
+            if (area.width <= 0 || area.height <= 0)
+            {
+                return;
+            }
+            std::uint64_t pending = refresh_.load(std::memory_order_relaxed);
+            std::uint64_t merged = 0;
+            do
+            {
+                CaptureRegion bounds = area;
+                const CaptureRegion previous = unpackRegion(pending);
+                if (previous.width > 0 && previous.height > 0)
+                {
+                    bounds.x = std::min(area.x, previous.x);
+                    bounds.y = std::min(area.y, previous.y);
+                    bounds.width = std::max(area.x + area.width, previous.x + previous.width) - bounds.x;
+                    bounds.height = std::max(area.y + area.height, previous.y + previous.height) - bounds.y;
+                }
+                merged = packRegion(bounds);
+            } while (!refresh_.compare_exchange_weak(pending, merged, std::memory_order_relaxed));
+        }
+
+        std::uint64_t droppedFrames() const
+        {
+            return dropped_.load(std::memory_order_relaxed);
+        }
+
+        std::uint64_t reusedFrames = 0;
+        std::uint64_t lateFrames = 0;
+
+    private:
+        // X coordinates are 16 bits wide, so a whole region fits in one lock-free word.
+        static std::uint64_t packRegion(const CaptureRegion &region)
+        {
+            const auto pack = [](int value) {
+                return static_cast<std::uint64_t>(static_cast<std::uint16_t>(static_cast<std::int16_t>(
+                    std::clamp(value, -32768, 32767))));
+            };
+            return pack(region.x) | pack(region.y) << 16 | pack(region.width) << 32 | pack(region.height) << 48;
+        }
+
+        static CaptureRegion unpackRegion(std::uint64_t packed)
+        {
+            const auto unpack = [packed](int shift) {
+                return static_cast<int>(static_cast<std::int16_t>(static_cast<std::uint16_t>(packed >> shift)));
+            };
+            return CaptureRegion{unpack(0), unpack(16), unpack(32), unpack(48)};
+        }
+
+        void run(const CaptureSettings &settings)
+        {
+            reduceTimerSlack();
+            ScreenCapture capture(settings);
+            std::vector<CaptureRect> published;
+            std::vector<CaptureRect> forced;
+            bool publishedCapture = true;
+            while (!stop_.load())
+            {
+                const auto start = std::chrono::steady_clock::now();
+
+                // Rects of a frame the consumer never picked up must ride along with the next one.
+                forced.clear();
+                if (frames_.pending())
+                {
+                    forced = published;
+                }
+
+                const CaptureRegion stale = unpackRegion(refresh_.exchange(0, std::memory_order_relaxed));
+                if (stale.width > 0 && stale.height > 0)
+                {
+                    forced.push_back(CaptureRect{stale.x, stale.y, stale.width, stale.height, nullptr, 0});
+                }
+                const CaptureRegion region = unpackRegion(region_.load(std::memory_order_relaxed));
+
+                CaptureSlot &slot = frames_.back();
+                const auto grabStart = std::chrono::steady_clock::now();
+                slot.captured = capture.grab(slot.frame, frames_.backIndex(), forced, region);
+                if (!slot.frame.rects.empty() || slot.captured != publishedCapture)
+                {
+                    slot.capturedAt = std::chrono::steady_clock::now();
+                    slot.grabTime = slot.capturedAt - grabStart;
+                    published.clear();
+                    for (const auto &rect : slot.frame.rects)
+                    {
+                        published.push_back(CaptureRect{rect.x, rect.y, rect.width, rect.height, nullptr, 0});
+                    }
+                    publishedCapture = slot.captured;
+                    if (frames_.publish())
+                    {
+                        dropped_.fetch_add(1, std::memory_order_relaxed);
+                    }
+                }
+
+                // Capture no faster than frames are displayed or --capture-fps allows; with XDamage, also sleep until
+                // something changes.
+                const auto interval =
+                    std::max(minInterval_, std::chrono::nanoseconds(renderInterval_.load(std::memory_order_relaxed)));
+                preciseSleepUntil(start + interval);
+                if (capture.tracksDamage() || !slot.captured)
+                {
+                    capture.waitForEvents(std::chrono::milliseconds(50));
+                }
+            }
+        }
+
+        TripleBuffer<CaptureSlot> frames_;
+        std::atomic<bool> stop_{false};
+        const std::chrono::nanoseconds minInterval_;
+        std::atomic<std::int64_t> renderInterval_{16666667};
+        std::atomic<std::uint64_t> dropped_{0};
+        std::atomic<std::uint64_t> region_{0};
+        std::atomic<std::uint64_t> refresh_{0};
+        std::thread thread_;
+    };
+
+    // Capture trace layout: the 8-byte magic, then one TraceFrameHeader per consumed frame, each followed by
+    // its rects. A rect is a TraceRectHeader and a payload that encodes the rect's rows (tightly packed) against
+    // the previous frame as repeated (u32 unchanged bytes, u32 literal bytes, literal data) runs. Values are in
+    // host byte order.
+    constexpr std::array<char, 8> kTraceMagic = {'C', 'R', 'T', 'T', 'R', 'C', '0', '1'};
+
+    struct TraceFrameHeader
+    {
+        std::uint64_t timestamp;
+        std::int32_t width;
+        std::int32_t height;
+        std::int32_t bitsPerPixel;
+        std::uint32_t redMask;
+        std::uint32_t greenMask;
+        std::uint32_t blueMask;
+        std::uint32_t msbFirst;
+        std::uint32_t rectCount;
+    };
+    static_assert(sizeof(TraceFrameHeader) == 40, "TraceFrameHeader must have no padding");
+
+    struct TraceRectHeader
+    {
+        std::int32_t x;
+        std::int32_t y;
+        std::int32_t width;
+        std::int32_t height;
+        std::uint32_t payloadBytes;
+    };
+    static_assert(sizeof(TraceRectHeader) == 20, "TraceRectHeader must have no padding");
+
+    // Unchanged stretches shorter than this stay inside a literal run; a token costs eight bytes.
+    constexpr size_t kTraceMinSkip = 16;
+
+    void appendTraceValue(std::vector<std::uint8_t> &out, std::uint32_t value)
+    {
+        const auto *bytes = reinterpret_cast<const std::uint8_t *>(&value);
+        out.insert(out.end(), bytes, bytes + sizeof(value));
+    }
+
+    void encodeTraceDelta(const std::uint8_t *current, const std::uint8_t *previous, size_t length,
+                          std::vector<std::uint8_t> &out)
+    {
+        size_t i = 0;
+        while (i < length)
+        {
+            const size_t skipStart = i;
+            while (i < length && current[i] == previous[i])
+            {
+                ++i;
+            }
+            const size_t literalStart = i;
+            size_t same = 0;
+            while (i < length && same < kTraceMinSkip)
+            {
+                same = current[i] == previous[i] ? same + 1 : 0;
+                ++i;
+            }
+            const size_t literalEnd = same >= kTraceMinSkip ? i - same : i;
+            i = literalEnd;
+            appendTraceValue(out, static_cast<std::uint32_t>(literalStart - skipStart));
+            appendTraceValue(out, static_cast<std::uint32_t>(literalEnd - literalStart));
+            out.insert(out.end(), current + literalStart, current + literalEnd);
+        }
+    }
+
+    // Applies an encoded payload onto `rows`, the previous frame's rect bytes; throws on malformed input.
+    void decodeTraceDelta(const std::uint8_t *payload, size_t payloadBytes, std::uint8_t *rows, size_t length)
+    {
+        size_t in = 0;
+        size_t out = 0;
+        while (in < payloadBytes)
+        {
+            std::uint32_t skip = 0;
+            std::uint32_t literal = 0;
+            if (payloadBytes - in < 8)
+            {
+                throw std::runtime_error("Corrupt capture trace: truncated run");
+            }
+            std::memcpy(&skip, payload + in, 4);
+            std::memcpy(&literal, payload + in + 4, 4);
+            in += 8;
+            if (skip > length - out || literal > length - out - skip || literal > payloadBytes - in)
+            {
+                throw std::runtime_error("Corrupt capture trace: run out of bounds");
+            }
+            out += skip;
+            std::memcpy(rows + out, payload + in, literal);
+            out += literal;
+            in += literal;
+        }
+    }
+
+    // Full frame buffer that trace deltas are encoded against (recording) or applied to (replay).
+    struct TraceShadow
+    {
+        int width = 0;
+        int height = 0;
+        int bytesPerPixel = 0;
+        std::vector<std::uint8_t> pixels;
+        std::vector<std::uint8_t> rows;
+
+        // Returns false when the frame format changed and the buffer was reset to zeros.
+        bool match(int frameWidth, int frameHeight, int frameBytesPerPixel)
+        {
+            if (width == frameWidth && height == frameHeight && bytesPerPixel == frameBytesPerPixel)
+            {
+                return true;
+            }
+            width = frameWidth;
+            height = frameHeight;
+            bytesPerPixel = frameBytesPerPixel;
+            pixels.assign(static_cast<size_t>(width) * static_cast<size_t>(height) * static_cast<size_t>(bytesPerPixel), 0);
+            return false;
+        }
+
+        size_t stride() const
+        {
+            return static_cast<size_t>(width * bytesPerPixel);
+        }
+
+        // Copies a rect of the buffer into `rows`, tightly packed.
+        void gather(const CaptureRect &rect)
+        {
+            const size_t rowBytes = static_cast<size_t>(rect.width * bytesPerPixel);
+            rows.resize(rowBytes * static_cast<size_t>(rect.height));
+            for (int y = 0; y < rect.height; ++y)
+            {
+                std::memcpy(rows.data() + rowBytes * static_cast<size_t>(y),
+                            pixels.data() + static_cast<size_t>(rect.y + y) * stride() +
+                                static_cast<size_t>(rect.x * bytesPerPixel),
+                            rowBytes);
+            }
+        }
+
+        void scatter(const CaptureRect &rect, const std::uint8_t *source, size_t sourceStride)
+        {
+            const size_t rowBytes = static_cast<size_t>(rect.width * bytesPerPixel);
+            for (int y = 0; y < rect.height; ++y)
+            {
+                std::memcpy(pixels.data() + static_cast<size_t>(rect.y + y) * stride() +
+                                static_cast<size_t>(rect.x * bytesPerPixel),
+                            source + sourceStride * static_cast<size_t>(y), rowBytes);
+            }
+        }
+    };
+
+    // Appends every frame the render loop consumes to a trace file.
+    class TraceRecorder
+    {
+    public:
+        explicit TraceRecorder(const std::string &path)
+            : stream_(path, std::ios::out | std::ios::binary | std::ios::trunc), path_(path)
+        {
+            if (!stream_)
+            {
+                throw std::runtime_error("Failed to open trace file: " + path);
+            }
+            stream_.write(kTraceMagic.data(), kTraceMagic.size());
+        }
+
+        void write(const CaptureSlot &slot)
+        {
+            const CaptureFrame &frame = slot.frame;
+            const int bytesPerPixel = frame.bitsPerPixel / 8;
+            if (!started_)
+            {
+                start_ = slot.capturedAt;
+                started_ = true;
+            }
+            shadow_.match(frame.width, frame.height, bytesPerPixel);
+
+            TraceFrameHeader header{};
+            header.timestamp = static_cast<std::uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(slot.capturedAt - start_).count());
+            header.width = frame.width;
+            header.height = frame.height;
+            header.bitsPerPixel = frame.bitsPerPixel;
+            header.redMask = static_cast<std::uint32_t>(frame.redMask);
+            header.greenMask = static_cast<std::uint32_t>(frame.greenMask);
+            header.blueMask = static_cast<std::uint32_t>(frame.blueMask);
+            header.msbFirst = frame.msbFirst ? 1u : 0u;
+            header.rectCount = static_cast<std::uint32_t>(frame.rects.size());
+            stream_.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+            for (const auto &rect : frame.rects)
+            {
+                shadow_.gather(rect);
+                current_.resize(shadow_.rows.size());
+                const size_t rowBytes = static_cast<size_t>(rect.width * bytesPerPixel);
+                for (int y = 0; y < rect.height; ++y)
+                {
+                    std::memcpy(current_.data() + rowBytes * static_cast<size_t>(y),
+                                rect.data + static_cast<size_t>(rect.bytesPerLine) * static_cast<size_t>(y), rowBytes);
+                }
+                payload_.clear();
+                encodeTraceDelta(current_.data(), shadow_.rows.data(), current_.size(), payload_);
+                shadow_.scatter(rect, current_.data(), rowBytes);
+
+                const TraceRectHeader rectHeader{rect.x, rect.y, rect.width, rect.height,
+                                                 static_cast<std::uint32_t>(payload_.size())};
+                stream_.write(reinterpret_cast<const char *>(&rectHeader), sizeof(rectHeader));
+                stream_.write(reinterpret_cast<const char *>(payload_.data()),
+                              static_cast<std::streamsize>(payload_.size()));
+            }
+            if (!stream_)
+            {
+                throw std::runtime_error("Failed to write trace file: " + path_);
+            }
+        }
+
+    private:
+        std::ofstream stream_;
+        std::string path_;
+        TraceShadow shadow_;
+        std::vector<std::uint8_t> current_;
+        std::vector<std::uint8_t> payload_;
+        std::chrono::steady_clock::time_point start_;
+        bool started_ = false;
+    };
+
+    // Memory-maps a trace and hands its frames out as capture slots, so they take the same upload path as a live
+    // capture. Playback loops at the end of the file.
+    class TraceReplay
+    {
+    public:
+        explicit TraceReplay(const std::string &path)
+        {
+#if CRT_HAS_MMAP
+            const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            struct stat info{};
+            if (fd < 0 || fstat(fd, &info) != 0)
+            {
+                if (fd >= 0)
+                {
+                    close(fd);
+                }
+                throw std::runtime_error("Failed to open trace file: " + path);
+            }
+            size_ = static_cast<size_t>(info.st_size);
+            void *mapped = size_ > 0 ? mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+            close(fd);
+            if (mapped == MAP_FAILED)
+            {
+                throw std::runtime_error("Failed to map trace file: " + path);
+            }
+            data_ = static_cast<const std::uint8_t *>(mapped);
+            madvise(mapped, size_, MADV_SEQUENTIAL);
+#else
+            std::ifstream stream(path, std::ios::in | std::ios::binary);
+            if (!stream)
+            {
+                throw std::runtime_error("Failed to open trace file: " + path);
+            }
+            fallback_.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+            data_ = fallback_.data();
+            size_ = fallback_.size();
+#endif
+            if (size_ < kTraceMagic.size() + sizeof(TraceFrameHeader) ||
+                std::memcmp(data_, kTraceMagic.data(), kTraceMagic.size()) != 0)
+            {
+                release();
+                throw std::runtime_error("Not a capture trace: " + path);
+            }
+            offset_ = kTraceMagic.size();
+            slot_.captured = true;
+            slot_.frame.backend = "replay";
+        }
+
+        ~TraceReplay()
+        {
+            release();
+        }
+
+        TraceReplay(const TraceReplay &) = delete;
+        TraceReplay &operator=(const TraceReplay &) = delete;
+
+        // Applies every frame that is due and returns them merged into one slot, or nullptr when none is. With
+        // `realtime` frames follow their recorded timestamps; otherwise every call advances exactly one frame.
+        const CaptureSlot *next(bool realtime)
+        {
+            const auto now = std::chrono::steady_clock::now();
+            if (!playing_)
+            {
+                playStart_ = now;
+                playing_ = true;
+            }
+
+            slot_.frame.rects.clear();
+            slot_.frame.damagedPixels = 0;
+            bool advanced = false;
+            bool wrapped = false;
+            while (!advanced || realtime)
+            {
+                if (offset_ + sizeof(TraceFrameHeader) > size_)
+                {
+                    // A call that already applied the last frame returns it; the loop restarts on the next call so
+                    // that frame is shown and frame 0 is timed from when it actually starts.
+                    if (advanced || wrapped)
+                    {
+                        break;
+                    }
+                    // Loop: the first frame is always encoded against an all-zero frame.
+                    wrapped = true;
+                    offset_ = kTraceMagic.size();
+                    shadow_ = TraceShadow{};
+                    playStart_ = now;
+                    slot_.frame.rects.clear();
+                }
+
+                TraceFrameHeader header{};
+                std::memcpy(&header, data_ + offset_, sizeof(header));
+                const auto due = playStart_ + std::chrono::nanoseconds(header.timestamp);
+                if (realtime && advanced && due > now)
+                {
+                    break;
+                }
+                if (realtime && !advanced && due > now)
+                {
+                    return nullptr;
+                }
+                applyFrame(header);
+                advanced = true;
+            }
+            if (!advanced)
+            {
+                return nullptr;
+            }
+            slot_.capturedAt = now;
+            return &slot_;
+        }
+
+    private:
+        void applyFrame(const TraceFrameHeader &header)
+        {
+            offset_ += sizeof(header);
+            const int bytesPerPixel = header.bitsPerPixel / 8;
+            if (header.width <= 0 || header.height <= 0 || (bytesPerPixel != 3 && bytesPerPixel != 4))
+            {
+                throw std::runtime_error("Corrupt capture trace: bad frame header");
+            }
+            if (!shadow_.match(header.width, header.height, bytesPerPixel))
+            {
+                slot_.frame.rects.clear();
+            }
+
+            CaptureFrame &frame = slot_.frame;
+            frame.width = header.width;
+            frame.height = header.height;
+            frame.bitsPerPixel = header.bitsPerPixel;
+            frame.redMask = header.redMask;
+            frame.greenMask = header.greenMask;
+            frame.blueMask = header.blueMask;
+            frame.msbFirst = header.msbFirst != 0;
+
+            for (std::uint32_t i = 0; i < header.rectCount; ++i)
+            {
+                TraceRectHeader rectHeader{};
+                if (offset_ + sizeof(rectHeader) > size_)
+                {
+                    throw std::runtime_error("Corrupt capture trace: truncated rect");
+                }
+                std::memcpy(&rectHeader, data_ + offset_, sizeof(rectHeader));
+                offset_ += sizeof(rectHeader);
+                if (rectHeader.x < 0 || rectHeader.y < 0 || rectHeader.width <= 0 || rectHeader.height <= 0 ||
+                    rectHeader.x + rectHeader.width > header.width || rectHeader.y + rectHeader.height > header.height ||
+                    rectHeader.payloadBytes > size_ - offset_)
+                {
+                    throw std::runtime_error("Corrupt capture trace: bad rect");
+                }
+
+                CaptureRect rect{rectHeader.x, rectHeader.y, rectHeader.width, rectHeader.height, nullptr, 0};
+                shadow_.gather(rect);
+                decodeTraceDelta(data_ + offset_, rectHeader.payloadBytes, shadow_.rows.data(), shadow_.rows.size());
+                shadow_.scatter(rect, shadow_.rows.data(), static_cast<size_t>(rect.width * bytesPerPixel));
+                offset_ += rectHeader.payloadBytes;
+
+                rect.data = shadow_.pixels.data() + static_cast<size_t>(rect.y) * shadow_.stride() +
+                            static_cast<size_t>(rect.x * bytesPerPixel);
+                rect.bytesPerLine = static_cast<int>(shadow_.stride());
+                frame.rects.push_back(rect);
+                frame.damagedPixels += static_cast<std::uint64_t>(rect.width) * static_cast<std::uint64_t>(rect.height);
+            }
+        }
+
+        void release()
+        {
+#if CRT_HAS_MMAP
+            if (data_)
+            {
+                munmap(const_cast<std::uint8_t *>(data_), size_);
+            }
+#endif
+            data_ = nullptr;
+        }
+
+        const std::uint8_t *data_ = nullptr;
+        size_t size_ = 0;
+        size_t offset_ = 0;
+#if !CRT_HAS_MMAP
+        std::vector<std::uint8_t> fallback_;
+#endif
+        TraceShadow shadow_;
+        CaptureSlot slot_;
+        std::chrono::steady_clock::time_point playStart_;
+        bool playing_ = false;
+    };
+
+    struct RawFrameBuffer
+    {
+        std::vector<std::uint8_t> pixels;
+        // Time the IO thread spent reading or writing it.
+        std::chrono::steady_clock::duration ioTime{};
+    };
+
+    // Fixed-size frame buffers circulating between the render loop and an IO thread. With two buffers one side
+    // fills or drains a frame while the other works on the previous one.
+    class FrameQueue
+    {
+    public:
+        FrameQueue(size_t depth, size_t frameBytes) : storage_(depth, RawFrameBuffer{std::vector<std::uint8_t>(frameBytes)})
+        {
+            for (auto &buffer : storage_)
+            {
+                free_.push_back(&buffer);
+            }
+        }
+
+        FrameQueue(const FrameQueue &) = delete;
+        FrameQueue &operator=(const FrameQueue &) = delete;
+
+        // Blocks until a buffer can be filled; nullptr once the queue is closed.
+        RawFrameBuffer *takeFree()
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            changed_.wait(lock, [this] { return !free_.empty() || closed_; });
+            if (closed_)
+            {
+                return nullptr;
+            }
+            return pop(free_);
+        }
+
+        // Blocks until a filled buffer is ready; after close() the remaining ones drain before nullptr.
+        RawFrameBuffer *takeFilled()
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            changed_.wait(lock, [this] { return !filled_.empty() || closed_; });
+            if (filled_.empty())
+            {
+                return nullptr;
+            }
+            return pop(filled_);
+        }
+
+        void putFree(RawFrameBuffer *buffer)
+        {
+            push(free_, buffer);
+        }
+
+        void putFilled(RawFrameBuffer *buffer)
+        {
+            push(filled_, buffer);
+        }
+
+        void close()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                closed_ = true;
+            }
+            changed_.notify_all();
+        }
+
+    private:
+        static RawFrameBuffer *pop(std::deque<RawFrameBuffer *> &list)
+        {
+            RawFrameBuffer *buffer = list.front();
+            list.pop_front();
+            return buffer;
+        }
+
+        void push(std::deque<RawFrameBuffer *> &list, RawFrameBuffer *buffer)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                list.push_back(buffer);
+            }
+            changed_.notify_all();
+        }
+
+        std::vector<RawFrameBuffer> storage_;
+        std::deque<RawFrameBuffer *> free_;
+        std::deque<RawFrameBuffer *> filled_;
+        std::mutex mutex_;
+        std::condition_variable changed_;
+        bool closed_ = false;
+    };
+
+    // Reads tightly packed RGBA8 frames from a file or stdin on its own thread, one frame ahead of the render
+    // loop, and presents each as a full-frame capture so it takes the regular upload and unpack path.
+    class RawFrameReader
+    {
+    public:
+        RawFrameReader(const std::string &path, int width, int height)
+            : queue_(2, static_cast<size_t>(width) * static_cast<size_t>(height) * 4)
+        {
+            file_ = path == "-" ? stdin : std::fopen(path.c_str(), "rb");
+            if (!file_)
+            {
+                throw std::runtime_error("Failed to open filter input: " + path);
+            }
+
+            CaptureFrame &frame = slot_.frame;
+            frame.width = width;
+            frame.height = height;
+            frame.bitsPerPixel = 32;
+            frame.redMask = 0x000000ff;
+            frame.greenMask = 0x0000ff00;
+            frame.blueMask = 0x00ff0000;
+            frame.damagedPixels = static_cast<std::uint64_t>(width) * static_cast<std::uint64_t>(height);
+            frame.backend = "raw RGBA";
+            slot_.captured = true;
+            thread_ = std::thread([this] { run(); });
+        }
+
+        ~RawFrameReader()
+        {
+            queue_.close();
+            thread_.join();
+            if (file_ != stdin)
+            {
+                std::fclose(file_);
+            }
+        }
+
+        RawFrameReader(const RawFrameReader &) = delete;
+        RawFrameReader &operator=(const RawFrameReader &) = delete;
+
+        // The next frame, or nullptr at the end of the input. The previous frame's buffer goes back to the reader,
+        // so the returned slot stays valid until the next call.
+        const CaptureSlot *next()
+        {
+            if (current_)
+            {
+                queue_.putFree(current_);
+            }
+            current_ = queue_.takeFilled();
+            if (!current_)
+            {
+                return nullptr;
+            }
+            CaptureFrame &frame = slot_.frame;
+            frame.rects.assign(1, CaptureRect{0, 0, frame.width, frame.height, current_->pixels.data(), frame.width * 4});
+            slot_.capturedAt = std::chrono::steady_clock::now();
+            slot_.grabTime = current_->ioTime;
+            return &slot_;
+        }
+
+    private:
+        void run()
+        {
+            while (RawFrameBuffer *buffer = queue_.takeFree())
+            {
+                const auto start = std::chrono::steady_clock::now();
+                const size_t read = std::fread(buffer->pixels.data(), 1, buffer->pixels.size(), file_);
+                if (read != buffer->pixels.size())
+                {
+                    if (std::ferror(file_))
+                    {
+                        std::cerr << "Filter input read failed: " << std::strerror(errno) << "\n";
+                    }
+                    else if (read > 0)
+                    {
+                        std::cerr << "Filter input ended inside a frame; dropped " << read << " bytes\n";
+                    }
+                    break;
+                }
+                // Reported as the capture time, so a slow producer upstream shows up in the timings.
+                buffer->ioTime = std::chrono::steady_clock::now() - start;
+                queue_.putFilled(buffer);
+            }
+            queue_.close();
+        }
+
+        std::FILE *file_ = nullptr;
+        FrameQueue queue_;
+        RawFrameBuffer *current_ = nullptr;
+        CaptureSlot slot_;
+        std::thread thread_;
+    };
+
+    // Writes finished frames to stdout on its own thread while the render loop works on the next ones.
+    class RawFrameWriter
+    {
+    public:
+        explicit RawFrameWriter(size_t frameBytes) : queue_(2, frameBytes)
+        {
+            thread_ = std::thread([this] { run(); });
+        }
+
+        ~RawFrameWriter()
+        {
+            finish();
+        }
+
+        RawFrameWriter(const RawFrameWriter &) = delete;
+        RawFrameWriter &operator=(const RawFrameWriter &) = delete;
+
+        // A buffer for the next output frame, or nullptr once writing has failed.
+        RawFrameBuffer *acquire()
+        {
+            return queue_.takeFree();
+        }
+
+        void submit(RawFrameBuffer *buffer)
+        {
+            queue_.putFilled(buffer);
+        }
+
+        // Waits until every submitted frame is written; false if a write failed.
+        bool finish()
+        {
+            if (thread_.joinable())
+            {
+                queue_.close();
+                thread_.join();
+            }
+            return !failed_;
+        }
+
+    private:
+        void run()
+        {
+            while (RawFrameBuffer *buffer = queue_.takeFilled())
+            {
+                if (!failed_ && std::fwrite(buffer->pixels.data(), 1, buffer->pixels.size(), stdout) !=
+                                    buffer->pixels.size())
+                {
+                    std::cerr << "Filter output write failed: " << std::strerror(errno) << "\n";
+                    failed_ = true;
+                    queue_.close();
+                }
+                queue_.putFree(buffer);
+            }
+            std::fflush(stdout);
+        }
+
+        FrameQueue queue_;
+        std::atomic<bool> failed_{false};
+        std::thread thread_;
+    };
+
+    struct UploadSlot
+    {
+        GLuint buffer = 0;
+        size_t capacity = 0;
+        std::uint8_t *mapped = nullptr;
+        GLsync fence = nullptr;
+    };
+
+    // Ring of pixel unpack buffers so texture uploads become asynchronous copies out of buffer memory.
+    struct UploadRing
+    {
+        std::vector<UploadSlot> slots;
+        size_t next = 0;
+        bool persistent = false;
+        std::uint64_t fenceWaits = 0;
+    };
+
+    UploadRing createUploadRing(size_t count)
+    {
+        UploadRing ring;
+        ring.slots.resize(count);
+        ring.persistent = count > 0 && hasGLExtension("GL_ARB_buffer_storage");
+        return ring;
+    }
+
+    void destroyUploadSlot(UploadSlot &slot)
+    {
+        if (slot.fence)
+        {
+            glDeleteSync(slot.fence);
+            slot.fence = nullptr;
+        }
+        if (slot.buffer)
+        {
+            if (slot.mapped)
+            {
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+                glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            }
+            glDeleteBuffers(1, &slot.buffer);
+        }
+        slot = UploadSlot{};
+    }
+
+    void destroyUploadRing(UploadRing &ring)
+    {
+        for (auto &slot : ring.slots)
+        {
+            destroyUploadSlot(slot);
+        }
+    }
+
+    // Maps the next slot for writing and leaves it bound to GL_PIXEL_UNPACK_BUFFER, so texture uploads issued
+    // before finishUpload source from it by offset.
+    std::uint8_t *beginUpload(UploadRing &ring, size_t size)
+    {
+        UploadSlot &slot = ring.slots[ring.next];
+        if (slot.fence)
+        {
+            if (glClientWaitSync(slot.fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+            {
+                ring.fenceWaits++;
+                glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull);
+            }
+            glDeleteSync(slot.fence);
+            slot.fence = nullptr;
+        }
+
+        if (slot.capacity < size)
+        {
+            destroyUploadSlot(slot);
+            glGenBuffers(1, &slot.buffer);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+            if (ring.persistent)
+            {
+                const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+                glBufferStorage(GL_PIXEL_UNPACK_BUFFER, static_cast<GLsizeiptr>(size), nullptr, flags);
+                slot.mapped = static_cast<std::uint8_t *>(
+                    glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, static_cast<GLsizeiptr>(size), flags));
+            }
+            slot.capacity = size;
+        }
+
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+        if (ring.persistent)
+        {
+            return slot.mapped;
+        }
+
+        // Orphaning hands the driver a fresh allocation instead of synchronizing with pending reads.
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, static_cast<GLsizeiptr>(slot.capacity), nullptr, GL_STREAM_DRAW);
+        return static_cast<std::uint8_t *>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, static_cast<GLsizeiptr>(size),
+                                                            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+    }
+
+    void finishUpload(UploadRing &ring)
+    {
+        UploadSlot &slot = ring.slots[ring.next];
+        slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        ring.next = (ring.next + 1) % ring.slots.size();
+    }
+
+    // Pixel pack buffers that glReadPixels copies into asynchronously. Each is fenced and only mapped a few frames
+    // later, once the GPU has finished the copy, so reading results back never stalls the pipeline.
+    struct ReadbackRing
+    {
+        std::vector<GLuint> buffers;
+        std::vector<GLsync> fences;
+        size_t next = 0;
+        size_t pending = 0;
+        int width = 0;
+        int height = 0;
+        std::uint64_t fenceWaits = 0;
+    };
+
+    ReadbackRing createReadbackRing(size_t count, int width, int height)
+    {
+        ReadbackRing ring;
+        ring.buffers.resize(std::max<size_t>(1, count));
+        ring.fences.resize(ring.buffers.size(), nullptr);
+        ring.width = width;
+        ring.height = height;
+        const auto size = static_cast<GLsizeiptr>(width) * height * 4;
+        glGenBuffers(static_cast<GLsizei>(ring.buffers.size()), ring.buffers.data());
+        for (const GLuint buffer : ring.buffers)
+        {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+            glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        return ring;
+    }
+
+    void destroyReadbackRing(ReadbackRing &ring)
+    {
+        for (GLsync &fence : ring.fences)
+        {
+            if (fence)
+            {
+                glDeleteSync(fence);
+            }
+        }
+        if (!ring.buffers.empty())
+        {
+            glDeleteBuffers(static_cast<GLsizei>(ring.buffers.size()), ring.buffers.data());
+        }
+        ring = ReadbackRing{};
+    }
+
+    // Queues a copy of `framebuffer` into the next slot; the caller collects first when all slots are pending.
+    void queueReadback(ReadbackRing &ring, GLuint framebuffer)
+    {
+        const size_t index = (ring.next + ring.pending) % ring.buffers.size();
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, ring.buffers[index]);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, ring.width, ring.height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        ring.fences[index] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        // Filtering never swaps, so nothing else submits the copy; without a flush the first poll of this fence
+        // would always miss and the wait would do the submitting.
+        glFlush();
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        ring.pending++;
+    }
+
+    // Copies the oldest queued frame to `out`, waiting for its fence if the GPU is still behind. Rows come out in
+    // texture order, which is the order the frame's rows went in.
+    void collectReadback(ReadbackRing &ring, std::uint8_t *out)
+    {
+        GLsync &fence = ring.fences[ring.next];
+        if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+        {
+            ring.fenceWaits++;
+            glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull);
+        }
+        glDeleteSync(fence);
+        fence = nullptr;
+
+        const auto size = static_cast<GLsizeiptr>(ring.width) * ring.height * 4;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, ring.buffers[ring.next]);
+        if (const void *mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT))
+        {
+            std::memcpy(out, mapped, static_cast<size_t>(size));
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        else
+        {
+            glGetBufferSubData(GL_PIXEL_PACK_BUFFER, 0, size, out);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        ring.next = (ring.next + 1) % ring.buffers.size();
+        ring.pending--;
+    }
+
+    // Hands the oldest readback to the writer thread; false once writing has failed.
+    bool writeFilteredFrame(ReadbackRing &ring, RawFrameWriter &writer)
+    {
+        RawFrameBuffer *buffer = writer.acquire();
+        if (!buffer)
+        {
+            return false;
+        }
+        collectReadback(ring, buffer->pixels.data());
+        writer.submit(buffer);
+        return true;
+    }
+
+    struct CaptureUnpacker
+    {
+        GLuint program = 0;
+        GLint rawTextureUniform = -1;
+        GLint bytesPerPixelUniform = -1;
+        GLint msbFirstUniform = -1;
+        GLint channelShiftUniform = -1;
+        GLint channelBitsUniform = -1;
+        GLuint rawTexture = 0;
+        GLenum rawFormat = 0;
+        int rawWidth = 0;
+        int rawHeight = 0;
+        RenderTarget output;
+        GLenum outputFormat = 0;
+        int width = 0;
+        int height = 0;
+        UploadRing uploads;
+        std::uint64_t uploadedBytes = 0;
+    };
+
+    CaptureUnpacker createCaptureUnpacker(size_t uploadBuffers, ProgramCache &cache)
+    {
+        CaptureUnpacker unpacker;
+        unpacker.uploads = createUploadRing(uploadBuffers);
+        unpacker.program = buildShaderProgram(std::string(kUnpackShader), cache, "capture unpack shader").program;
+        unpacker.rawTextureUniform = glGetUniformLocation(unpacker.program, "RawTexture");
+        unpacker.bytesPerPixelUniform = glGetUniformLocation(unpacker.program, "BytesPerPixel");
+        unpacker.msbFirstUniform = glGetUniformLocation(unpacker.program, "MsbFirst");
+        unpacker.channelShiftUniform = glGetUniformLocation(unpacker.program, "ChannelShift");
+        unpacker.channelBitsUniform = glGetUniformLocation(unpacker.program, "ChannelBits");
+        return unpacker;
+    }
+
+    void destroyCaptureUnpacker(CaptureUnpacker &unpacker)
+    {
+        destroyUploadRing(unpacker.uploads);
+        destroyRenderTarget(unpacker.output);
+        if (unpacker.rawTexture)
+        {
+            glDeleteTextures(1, &unpacker.rawTexture);
+            unpacker.rawTexture = 0;
+        }
+        if (unpacker.program)
+        {
+            glDeleteProgram(unpacker.program);
+            unpacker.program = 0;
+        }
+    }
+
+    // Appends the parts of `rect` outside `hole` as up to four bands: full-width above and below, then the left
+    // and right pieces beside it.
+    void subtractRegion(const CaptureRect &rect, const CaptureRegion &hole, int bytesPerPixel,
+                        std::vector<CaptureRect> &bands)
+    {
+        const int left = std::max(rect.x, hole.x);
+        const int top = std::max(rect.y, hole.y);
+        const int right = std::min(rect.x + rect.width, hole.x + hole.width);
+        const int bottom = std::min(rect.y + rect.height, hole.y + hole.height);
+        if (right <= left || bottom <= top)
+        {
+            bands.push_back(rect);
+            return;
+        }
+
+        const auto band = [&](int x, int y, int width, int height) {
+            if (width <= 0 || height <= 0)
+            {
+                return;
+            }
+            const size_t offset = static_cast<size_t>(y - rect.y) * static_cast<size_t>(rect.bytesPerLine) +
+                                  static_cast<size_t>((x - rect.x) * bytesPerPixel);
+            bands.push_back(CaptureRect{x, y, width, height, rect.data + offset, rect.bytesPerLine});
+        };
+        band(rect.x, rect.y, rect.width, top - rect.y);
+        band(rect.x, bottom, rect.width, rect.y + rect.height - bottom);
+        band(rect.x, top, left - rect.x, bottom - top);
+        band(right, top, rect.x + rect.width - right, bottom - top);
+    }
+
+    // Deep-color visuals keep their extra precision instead of being truncated to 8 bits per channel.
+    GLenum captureOutputFormat(const CaptureFrame &frame)
+    {
+        return std::max({maskSize(frame.redMask), maskSize(frame.greenMask), maskSize(frame.blueMask)}) > 8
+                   ? GL_RGB10_A2
+                   : GL_RGBA8;
+    }
+
+    // Uploads the changed rows untouched and converts them to RGBA with one scissored draw per rect into
+    // unpacker.output; everything outside the rects keeps the previous frame. Pixels inside `excluded` (the
+    // overlay window itself) are never uploaded, so last frame's content stays there without an extra pass.
+    // With a `destination` (a history slot) the whole frame is converted from the raw texture into it instead,
+    // while the upload stays limited to the changed rows.
+    void unpackCapture(CaptureUnpacker &unpacker, const CaptureFrame &frame, GLuint vao, const CaptureRegion &excluded,
+                       const RenderTarget *destination = nullptr)
+    {
+        unpacker.uploadedBytes = 0;
+        const int bytesPerPixel = frame.bitsPerPixel / 8;
+        // A fresh output texture has no previous frame to keep, so the first upload after a resize is whole.
+        const bool outputReady = (destination || unpacker.output.framebuffer) && frame.width == unpacker.width &&
+                                 frame.height == unpacker.height;
+        std::vector<CaptureRect> rects;
+        for (const auto &rect : frame.rects)
+        {
+            if (outputReady && excluded.width > 0 && excluded.height > 0)
+            {
+                subtractRegion(rect, excluded, bytesPerPixel, rects);
+            }
+            else
+            {
+                rects.push_back(rect);
+            }
+        }
+        if (rects.empty() && !destination)
+        {
+            return;
+        }
+
+        // One pixel per texel: RGBA8UI for 32bpp rows, RGB8UI for packed 24bpp rows, so the raw texture is no
+        // wider than the desktop.
+        const GLenum rawFormat = bytesPerPixel == 4 ? GL_RGBA8UI : GL_RGB8UI;
+        const GLenum rawLayout = bytesPerPixel == 4 ? GL_RGBA_INTEGER : GL_RGB_INTEGER;
+        const int rawWidth = frame.width;
+
+        if (!unpacker.rawTexture || rawFormat != unpacker.rawFormat || rawWidth != unpacker.rawWidth ||
+            frame.height != unpacker.rawHeight)
+        {
+            checkTextureSize(rawWidth, frame.height, "Capture size");
+            if (unpacker.rawTexture)
+            {
+                glDeleteTextures(1, &unpacker.rawTexture);
+            }
+            glGenTextures(1, &unpacker.rawTexture);
+            glBindTexture(GL_TEXTURE_2D, unpacker.rawTexture);
+            glTexImage2D(GL_TEXTURE_2D, 0, static_cast<GLint>(rawFormat), rawWidth, frame.height, 0, rawLayout,
+                         GL_UNSIGNED_BYTE, nullptr);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            unpacker.rawFormat = rawFormat;
+            unpacker.rawWidth = rawWidth;
+            unpacker.rawHeight = frame.height;
+        }
+        else
+        {
+            glBindTexture(GL_TEXTURE_2D, unpacker.rawTexture);
+        }
+
+        size_t total = 0;
+        for (const auto &rect : rects)
+        {
+            total += static_cast<size_t>(rect.width * bytesPerPixel) * static_cast<size_t>(rect.height);
+        }
+        unpacker.uploadedBytes = total;
+
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        // An undamaged frame still converts into a history slot but has nothing to upload; a zero-sized map or
+        // orphan of an unallocated slot is a GL error, so it takes the direct path with no rects instead.
+        std::uint8_t *mapped =
+            unpacker.uploads.slots.empty() || total == 0 ? nullptr : beginUpload(unpacker.uploads, total);
+        if (mapped)
+        {
+            // Rows are packed tightly into the mapped buffer; the uploads then read from it asynchronously.
+            size_t offset = 0;
+            for (const auto &rect : rects)
+            {
+                const size_t rowBytes = static_cast<size_t>(rect.width * bytesPerPixel);
+                for (int y = 0; y < rect.height; ++y)
+                {
+                    std::memcpy(mapped + offset + rowBytes * static_cast<size_t>(y),
+                                rect.data + static_cast<size_t>(rect.bytesPerLine) * static_cast<size_t>(y), rowBytes);
+                }
+                offset += rowBytes * static_cast<size_t>(rect.height);
+            }
+            if (!unpacker.uploads.persistent)
+            {
+                glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            }
+
+            offset = 0;
+            for (const auto &rect : rects)
+            {
+                glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x, rect.y, rect.width, rect.height, rawLayout, GL_UNSIGNED_BYTE,
+                                reinterpret_cast<const void *>(offset));
+                offset += static_cast<size_t>(rect.width * bytesPerPixel) * static_cast<size_t>(rect.height);
+            }
+            finishUpload(unpacker.uploads);
+        }
+        else
+        {
+            // Without a mapped buffer the driver copies straight out of the capture image.
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            for (const auto &rect : rects)
+            {
+                // GL_UNPACK_ROW_LENGTH counts whole pixels. A 24bpp stride padded to 32 bits is reached by rounding
+                // the row up to the alignment instead; any other partial-pixel stride goes up a row at a time.
+                const int stride = rect.bytesPerLine;
+                if (stride % bytesPerPixel == 0 || stride % 4 == 0)
+                {
+                    glPixelStorei(GL_UNPACK_ALIGNMENT, stride % bytesPerPixel == 0 ? 1 : 4);
+                    glPixelStorei(GL_UNPACK_ROW_LENGTH, stride / bytesPerPixel);
+                    glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x, rect.y, rect.width, rect.height, rawLayout,
+                                    GL_UNSIGNED_BYTE, rect.data);
+                    continue;
+                }
+                glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+                glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+                for (int y = 0; y < rect.height; ++y)
+                {
+                    glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x, rect.y + y, rect.width, 1, rawLayout, GL_UNSIGNED_BYTE,
+                                    rect.data + static_cast<size_t>(stride) * static_cast<size_t>(y));
+                }
+            }
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+        const int redBits = maskSize(frame.redMask);
+        const int greenBits = maskSize(frame.greenMask);
+        const int blueBits = maskSize(frame.blueMask);
+        const GLenum outputFormat = captureOutputFormat(frame);
+        // The whole frame is converted whenever the target does not already hold the previous one.
+        bool wholeFrame = destination != nullptr;
+        if (destination)
+        {
+            // History slots replace the incremental output; it is rebuilt from the raw texture if history is
+            // switched off again.
+            destroyRenderTarget(unpacker.output);
+            unpacker.width = frame.width;
+            unpacker.height = frame.height;
+        }
+        else if (!unpacker.output.framebuffer || outputFormat != unpacker.outputFormat ||
+                 frame.width != unpacker.width || frame.height != unpacker.height)
+        {
+            destroyRenderTarget(unpacker.output);
+            unpacker.output = createRenderTarget(frame.width, frame.height, outputFormat);
+            unpacker.outputFormat = outputFormat;
+            unpacker.width = frame.width;
+            unpacker.height = frame.height;
+            wholeFrame = true;
+        }
+        if (wholeFrame)
+        {
+            rects.assign(1, CaptureRect{0, 0, frame.width, frame.height, nullptr, 0});
+        }
+
+        glBindFramebuffer(GL_FRAMEBUFFER, destination ? destination->framebuffer : unpacker.output.framebuffer);
+        glViewport(0, 0, frame.width, frame.height);
+
+        glUseProgram(unpacker.program);
+        glUniform1i(unpacker.rawTextureUniform, 0);
+        glUniform1i(unpacker.bytesPerPixelUniform, bytesPerPixel);
+        glUniform1i(unpacker.msbFirstUniform, frame.msbFirst ? 1 : 0);
+        glUniform3i(unpacker.channelShiftUniform, maskShift(frame.redMask), maskShift(frame.greenMask),
+                    maskShift(frame.blueMask));
+        glUniform3i(unpacker.channelBitsUniform, redBits, greenBits, blueBits);
+
+        // Bound again here: creating the output target above leaves texture 0 bound.
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, unpacker.rawTexture);
+        glBindVertexArray(vao);
+        glEnable(GL_SCISSOR_TEST);
+        for (const auto &rect : rects)
+        {
+            // Output row y holds raw row y, so scissor boxes use desktop coordinates directly.
+            glScissor(rect.x, rect.y, rect.width, rect.height);
+            glDrawArrays(GL_TRIANGLES, 0, 6);
+        }
+        glDisable(GL_SCISSOR_TEST);
+        glBindVertexArray(0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    // GPU-rendered stand-in for the desktop, so the shader chain can be loaded without a desktop or CPU work.
+    struct ProceduralSource
+    {
+        SourceKind kind = SourceKind::Gradient;
+        GLuint program = 0;
+        GLint modeUniform = -1;
+        GLint frameUniform = -1;
+        GLint sizeUniform = -1;
+        RenderTarget target;
+        bool primed = false;
+    };
+
+    ProceduralSource createProceduralSource(SourceKind kind, int width, int height, ProgramCache &cache)
+    {
+        ProceduralSource source;
+        source.kind = kind;
+        source.program = buildShaderProgram(std::string(kSourceShader), cache, "source shader").program;
+        source.modeUniform = glGetUniformLocation(source.program, "Mode");
+        source.frameUniform = glGetUniformLocation(source.program, "Frame");
+        source.sizeUniform = glGetUniformLocation(source.program, "Size");
+        source.target = createRenderTarget(width, height);
+        return source;
+    }
+
+    void destroyProceduralSource(ProceduralSource &source)
+    {
+        destroyRenderTarget(source.target);
+        if (source.program)
+        {
+            glDeleteProgram(source.program);
+        }
+        source = ProceduralSource{};
+    }
+
+    // Renders this frame's source image. The damage source draws a static gradient once and afterwards only
+    // four small moving noise rectangles, like a desktop with a few animated windows. A `destination` history
+    // slot holds an older frame, so there the gradient is drawn every time.
+    void renderProceduralSource(ProceduralSource &source, GLuint vao, int frame,
+                                const RenderTarget *destination = nullptr)
+    {
+        const int width = source.target.width;
+        const int height = source.target.height;
+        if (destination)
+        {
+            source.primed = false;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, destination ? destination->framebuffer : source.target.framebuffer);
+        glViewport(0, 0, width, height);
+        glDisable(GL_BLEND);
+        glUseProgram(source.program);
+        glUniform2f(source.sizeUniform, static_cast<float>(width), static_cast<float>(height));
+        glBindVertexArray(vao);
+
+        if (source.kind == SourceKind::Damage)
+        {
+            if (!source.primed)
+            {
+                glUniform1i(source.modeUniform, 0);
+                glUniform1i(source.frameUniform, 0);
+                glDrawArrays(GL_TRIANGLES, 0, 6);
+                source.primed = !destination;
+            }
+            glUniform1i(source.modeUniform, 2);
+            glUniform1i(source.frameUniform, frame);
+            glEnable(GL_SCISSOR_TEST);
+            const int rectWidth = std::max(1, width / 8);
+            const int rectHeight = std::max(1, height / 8);
+            for (int i = 0; i < 4; ++i)
+            {
+                const double t = frame * 0.02 * (i + 1) + i;
+                const int x = static_cast<int>((0.5 + 0.45 * std::sin(t)) * (width - rectWidth));
+                const int y = static_cast<int>((0.5 + 0.45 * std::cos(t * 1.3)) * (height - rectHeight));
+                glScissor(x, y, rectWidth, rectHeight);
+                glDrawArrays(GL_TRIANGLES, 0, 6);
+            }
+            glDisable(GL_SCISSOR_TEST);
+        }
+        else
+        {
+            // Gradient, Text and Noise map to shader modes 0, 1 and 2.
+            glUniform1i(source.modeUniform, static_cast<int>(source.kind) - static_cast<int>(SourceKind::Gradient));
+            glUniform1i(source.frameUniform, frame);
+            glDrawArrays(GL_TRIANGLES, 0, 6);
+        }
+
+        glBindVertexArray(0);
+        glEnable(GL_BLEND);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+#if CRT_HAS_COMPOSITE
+    constexpr std::string_view kCompositeShader = R"GLSL(
+        #if defined(VERTEX)
+        layout(location = 0) in vec4 VertexCoord;
+        void main() {
+            gl_Position = VertexCoord;
+        }
+        #elif defined(FRAGMENT)
+        out vec4 FragColor;
+        uniform sampler2D WindowTexture;
+        uniform ivec4 WindowRect;
+        uniform bool YInverted;
+        void main() {
+            // Output row y is desktop row y, as in the unpack pass.
+            vec2 uv = (gl_FragCoord.xy - vec2(WindowRect.xy)) / vec2(WindowRect.zw);
+            if (!YInverted) {
+                uv.y = 1.0 - uv.y;
+            }
+            FragColor = vec4(texture(WindowTexture, uv).rgb, 1.0);
+        }
+        #endif
+    )GLSL";
+
+    // Zero-copy desktop capture: top-level windows are redirected offscreen with XComposite and their pixmaps are
+    // bound as textures through GLX_EXT_texture_from_pixmap, then drawn into one desktop-sized target in stacking
+    // order. Window pixels stay in GPU memory; nothing is read into the process.
+    class CompositeCapture
+    {
+    public:
+        // `target` is a window id, or 0 to composite every top-level window except the CRT window. Throws when
+        // the X server or the GL driver lacks the extensions, so the caller can fall back to CPU capture.
+        CompositeCapture(SDL_Window *window, unsigned long target, ProgramCache &cache)
+        {
+            glDisplay_ = glXGetCurrentDisplay();
+            if (!glDisplay_)
+            {
+                throw std::runtime_error("the GL context is not a GLX context");
+            }
+            const char *glxExtensions = glXQueryExtensionsString(glDisplay_, DefaultScreen(glDisplay_));
+            bindTexImage_ = reinterpret_cast<PFNGLXBINDTEXIMAGEEXTPROC>(
+                glXGetProcAddress(reinterpret_cast<const GLubyte *>("glXBindTexImageEXT")));
+            releaseTexImage_ = reinterpret_cast<PFNGLXRELEASETEXIMAGEEXTPROC>(
+                glXGetProcAddress(reinterpret_cast<const GLubyte *>("glXReleaseTexImageEXT")));
+            if (!glxExtensions || !std::strstr(glxExtensions, "GLX_EXT_texture_from_pixmap") || !bindTexImage_ ||
+                !releaseTexImage_)
+            {
+                throw std::runtime_error("GLX_EXT_texture_from_pixmap is not supported");
+            }
+
+            // Events and redirection use a connection of our own; SDL's event loop would swallow them on its own.
+            display_ = XOpenDisplay(nullptr);
             if (!display_)
             {
-                return false;
+                throw std::runtime_error("cannot open the X display");
+            }
+            int eventBase = 0;
+            int errorBase = 0;
+            int major = 0;
+            int minor = 2;
+            if (!XCompositeQueryExtension(display_, &eventBase, &errorBase) ||
+                !XCompositeQueryVersion(display_, &major, &minor) || (major == 0 && minor < 2))
+            {
+                XCloseDisplay(display_);
+                throw std::runtime_error("XComposite 0.2 is not available");
+            }
+
+            // Built before any window is redirected, so a failure here has only the display to give back.
+            try
+            {
+                program_ = buildShaderProgram(std::string(kCompositeShader), cache, "composite capture shader").program;
+            }
+            catch (...)
+            {
+                XCloseDisplay(display_);
+                throw;
+            }
+            windowTextureUniform_ = glGetUniformLocation(program_, "WindowTexture");
+            windowRectUniform_ = glGetUniformLocation(program_, "WindowRect");
+            yInvertedUniform_ = glGetUniformLocation(program_, "YInverted");
+
+            root_ = DefaultRootWindow(display_);
+            target_ = target;
+            SDL_SysWMinfo info;
+            SDL_VERSION(&info.version);
+            if (SDL_GetWindowWMInfo(window, &info) && info.subsystem == SDL_SYSWM_X11)
+            {
+                ownWindow_ = info.info.x11.window;
+            }
+
+            // Automatic redirection keeps the screen updating normally and coexists with a running compositor.
+            if (target_)
+            {
+                XCompositeRedirectWindow(display_, target_, CompositeRedirectAutomatic);
+                XSelectInput(display_, target_, StructureNotifyMask);
+            }
+            else
+            {
+                XCompositeRedirectSubwindows(display_, root_, CompositeRedirectAutomatic);
+            }
+            XSelectInput(display_, root_, SubstructureNotifyMask | StructureNotifyMask);
+            XSync(display_, False);
+        }
+
+        ~CompositeCapture()
+        {
+            for (auto &bound : windows_)
+            {
+                releaseWindow(bound);
+            }
+            destroyRenderTarget(output_);
+            glDeleteProgram(program_);
+            if (target_)
+            {
+                XCompositeUnredirectWindow(display_, target_, CompositeRedirectAutomatic);
+            }
+            else
+            {
+                XCompositeUnredirectSubwindows(display_, root_, CompositeRedirectAutomatic);
+            }
+            XCloseDisplay(display_);
+        }
+
+        CompositeCapture(const CompositeCapture &) = delete;
+        CompositeCapture &operator=(const CompositeCapture &) = delete;
+
+        const RenderTarget &output() const
+        {
+            return output_;
+        }
+
+        // Desktop size as of the last poll().
+        int width() const
+        {
+            return desktopWidth_;
+        }
+
+        int height() const
+        {
+            return desktopHeight_;
+        }
+
+        // Applies pending window changes. capture() does this itself; calling it first lets the caller size a
+        // destination for the coming frame.
+        void poll()
+        {
+            while (XPending(display_) > 0)
+            {
+                XEvent event;
+                XNextEvent(display_, &event);
+                if (event.type == MapNotify)
+                {
+                    // Mapping allocates a new backing pixmap, so the old binding would show stale content.
+                    remapped_.insert(event.xmap.window);
+                }
+                dirty_ = true;
+            }
+            if (dirty_)
+            {
+                refreshWindows();
+                dirty_ = false;
+            }
+        }
+
+        // Redraws every window into output(), or into `destination` when given. Pixmaps are only re-bound when
+        // a window is mapped, resized or replaced; moves and restacking just change where it is drawn.
+        void capture(GLuint vao, const RenderTarget *destination = nullptr)
+        {
+            poll();
+            if (destination)
+            {
+                destroyRenderTarget(output_);
+            }
+            else if (!output_.framebuffer || output_.width != desktopWidth_ || output_.height != desktopHeight_)
+            {
+                destroyRenderTarget(output_);
+                output_ = createRenderTarget(desktopWidth_, desktopHeight_);
+            }
+            const RenderTarget &target = destination ? *destination : output_;
+            glBindFramebuffer(GL_FRAMEBUFFER, target.framebuffer);
+            glViewport(0, 0, target.width, target.height);
+            glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+            glClear(GL_COLOR_BUFFER_BIT);
+
+            glUseProgram(program_);
+            glUniform1i(windowTextureUniform_, 0);
+            glActiveTexture(GL_TEXTURE0);
+            glBindVertexArray(vao);
+            glEnable(GL_SCISSOR_TEST);
+            for (const auto &bound : windows_)
+            {
+                const int left = std::max(0, bound.x);
+                const int top = std::max(0, bound.y);
+                const int right = std::min(target.width, bound.x + bound.width);
+                const int bottom = std::min(target.height, bound.y + bound.height);
+                if (right <= left || bottom <= top)
+                {
+                    continue;
+                }
+                glBindTexture(GL_TEXTURE_2D, bound.texture);
+                bindTexImage_(glDisplay_, bound.glxPixmap, GLX_FRONT_LEFT_EXT, nullptr);
+                glUniform4i(windowRectUniform_, bound.x, bound.y, bound.width, bound.height);
+                glUniform1i(yInvertedUniform_, bound.yInverted ? 1 : 0);
+                glScissor(left, top, right - left, bottom - top);
+                glDrawArrays(GL_TRIANGLES, 0, 6);
+                releaseTexImage_(glDisplay_, bound.glxPixmap, GLX_FRONT_LEFT_EXT);
+            }
+            glDisable(GL_SCISSOR_TEST);
+            glBindVertexArray(0);
+            glBindTexture(GL_TEXTURE_2D, 0);
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        }
+
+    private:
+        struct BoundWindow
+        {
+            Window window = 0;
+            int x = 0;
+            int y = 0;
+            int width = 0;
+            int height = 0;
+            Pixmap pixmap = 0;
+            GLXPixmap glxPixmap = 0;
+            GLuint texture = 0;
+            bool yInverted = false;
+        };
+
+        struct PixmapConfig
+        {
+            GLXFBConfig config = nullptr;
+            bool rgba = false;
+            bool yInverted = false;
+        };
+
+        static int recordXError(Display *, XErrorEvent *)
+        {
+            xErrorOccurred_ = true;
+            return 0;
+        }
+
+        // The GLX framebuffer config that can bind pixmaps of `visual` as 2D textures, if any.
+        const PixmapConfig *configFor(Visual *visual, int depth)
+        {
+            const VisualID id = XVisualIDFromVisual(visual);
+            const auto known = configs_.find(id);
+            if (known != configs_.end())
+            {
+                return known->second.config ? &known->second : nullptr;
+            }
+
+            PixmapConfig found;
+            int count = 0;
+            GLXFBConfig *configs = glXGetFBConfigs(glDisplay_, DefaultScreen(glDisplay_), &count);
+            for (int i = 0; i < count && !found.config; ++i)
+            {
+                const auto attribute = [&](int name) {
+                    int value = 0;
+                    glXGetFBConfigAttrib(glDisplay_, configs[i], name, &value);
+                    return value;
+                };
+                const bool rgba = depth == 32;
+                if (static_cast<VisualID>(attribute(GLX_VISUAL_ID)) != id ||
+                    !(attribute(GLX_DRAWABLE_TYPE) & GLX_PIXMAP_BIT) ||
+                    !(attribute(GLX_BIND_TO_TEXTURE_TARGETS_EXT) & GLX_TEXTURE_2D_BIT_EXT) ||
+                    !attribute(rgba ? GLX_BIND_TO_TEXTURE_RGBA_EXT : GLX_BIND_TO_TEXTURE_RGB_EXT))
+                {
+                    continue;
+                }
+                found.config = configs[i];
+                found.rgba = rgba;
+                found.yInverted = attribute(GLX_Y_INVERTED_EXT) == True;
+            }
+            if (configs)
+            {
+                XFree(configs);
+            }
+            const auto inserted = configs_.emplace(id, found).first;
+            return found.config ? &inserted->second : nullptr;
+        }
+
+        // The child of the root that holds `window`, usually the window manager's frame around it.
+        Window topLevelOf(Window window)
+        {
+            while (window)
+            {
+                Window rootReturn = 0;
+                Window parent = 0;
+                Window *children = nullptr;
+                unsigned int count = 0;
+                if (!XQueryTree(display_, window, &rootReturn, &parent, &children, &count))
+                {
+                    return 0;
+                }
+                if (children)
+                {
+                    XFree(children);
+                }
+                if (parent == rootReturn)
+                {
+                    return window;
+                }
+                window = parent;
+            }
+            return 0;
+        }
+
+        void refreshWindows()
+        {
+            // Windows can disappear between any two requests; those errors just drop the window.
+            XErrorHandler previous = XSetErrorHandler(recordXError);
+
+            XWindowAttributes rootAttrs;
+            if (XGetWindowAttributes(display_, root_, &rootAttrs))
+            {
+                desktopWidth_ = rootAttrs.width;
+                desktopHeight_ = rootAttrs.height;
+            }
+
+            std::vector<Window> stacking;
+            if (target_)
+            {
+                stacking.push_back(target_);
+            }
+            else
+            {
+                Window rootReturn = 0;
+                Window parent = 0;
+                Window *children = nullptr;
+                unsigned int count = 0;
+                if (XQueryTree(display_, root_, &rootReturn, &parent, &children, &count) && children)
+                {
+                    // Bottom to top, so later windows are drawn over earlier ones.
+                    stacking.assign(children, children + count);
+                    XFree(children);
+                }
+            }
+            const Window ownTopLevel = ownWindow_ ? topLevelOf(ownWindow_) : 0;
+
+            std::vector<BoundWindow> next;
+            for (const Window window : stacking)
+            {
+                XWindowAttributes attrs;
+                xErrorOccurred_ = false;
+                if (window == ownTopLevel || !XGetWindowAttributes(display_, window, &attrs) ||
+                    attrs.map_state != IsViewable || attrs.c_class == InputOnly)
+                {
+                    continue;
+                }
+                // Named pixmaps include the border; positions are of its outer corner in root coordinates.
+                int x = attrs.x;
+                int y = attrs.y;
+                if (target_)
+                {
+                    Window child = 0;
+                    XTranslateCoordinates(display_, window, root_, 0, 0, &x, &y, &child);
+                    x -= attrs.border_width;
+                    y -= attrs.border_width;
+                }
+                const int width = attrs.width + 2 * attrs.border_width;
+                const int height = attrs.height + 2 * attrs.border_width;
+
+                const auto existing = std::find_if(windows_.begin(), windows_.end(), [&](const BoundWindow &bound) {
+                    return bound.window == window && bound.width == width && bound.height == height;
+                });
+                if (existing != windows_.end() && remapped_.count(window) == 0)
+                {
+                    BoundWindow bound = *existing;
+                    existing->window = 0;
+                    bound.x = x;
+                    bound.y = y;
+                    next.push_back(bound);
+                    continue;
+                }
+
+                const PixmapConfig *config = configFor(attrs.visual, attrs.depth);
+                if (!config)
+                {
+                    continue;
+                }
+                BoundWindow bound;
+                bound.window = window;
+                bound.x = x;
+                bound.y = y;
+                bound.width = width;
+                bound.height = height;
+                bound.yInverted = config->yInverted;
+                bound.pixmap = XCompositeNameWindowPixmap(display_, window);
+                XSync(display_, False);
+                if (xErrorOccurred_)
+                {
+                    continue;
+                }
+                const int attribs[] = {GLX_TEXTURE_TARGET_EXT,
+                                       GLX_TEXTURE_2D_EXT,
+                                       GLX_TEXTURE_FORMAT_EXT,
+                                       config->rgba ? GLX_TEXTURE_FORMAT_RGBA_EXT : GLX_TEXTURE_FORMAT_RGB_EXT,
+                                       None};
+                bound.glxPixmap = glXCreatePixmap(glDisplay_, config->config, bound.pixmap, attribs);
+                XSync(glDisplay_, False);
+                if (xErrorOccurred_ || !bound.glxPixmap)
+                {
+                    releaseWindow(bound);
+                    continue;
+                }
+                glGenTextures(1, &bound.texture);
+                glBindTexture(GL_TEXTURE_2D, bound.texture);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+                glBindTexture(GL_TEXTURE_2D, 0);
+                next.push_back(bound);
+            }
+
+            for (auto &bound : windows_)
+            {
+                if (bound.window)
+                {
+                    releaseWindow(bound);
+                }
+            }
+            windows_ = std::move(next);
+            remapped_.clear();
+            XSync(glDisplay_, False);
+            XSync(display_, False);
+            XSetErrorHandler(previous);
+        }
+
+        void releaseWindow(BoundWindow &bound)
+        {
+            if (bound.texture)
+            {
+                glDeleteTextures(1, &bound.texture);
+            }
+            if (bound.glxPixmap)
+            {
+                glXDestroyPixmap(glDisplay_, bound.glxPixmap);
+            }
+            if (bound.pixmap)
+            {
+                XFreePixmap(display_, bound.pixmap);
+            }
+            bound = BoundWindow{};
+        }
+
+        Display *display_ = nullptr;
+        Display *glDisplay_ = nullptr;
+        Window root_ = 0;
+        Window target_ = 0;
+        Window ownWindow_ = 0;
+        int desktopWidth_ = 0;
+        int desktopHeight_ = 0;
+        bool dirty_ = true;
+        PFNGLXBINDTEXIMAGEEXTPROC bindTexImage_ = nullptr;
+        PFNGLXRELEASETEXIMAGEEXTPROC releaseTexImage_ = nullptr;
+        GLuint program_ = 0;
+        GLint windowTextureUniform_ = -1;
+        GLint windowRectUniform_ = -1;
+        GLint yInvertedUniform_ = -1;
+        std::map<VisualID, PixmapConfig> configs_;
+        std::vector<BoundWindow> windows_;
+        std::set<Window> remapped_;
+        RenderTarget output_;
+        static inline bool xErrorOccurred_ = false;
+    };
+#endif
+
+    // The overlay's own window in capture pixels, clipped to the capture; empty when they do not overlap.
+    CaptureRegion windowExclusion(SDL_Window *window, int captureX, int captureY, int captureWidth, int captureHeight)
+    {
+        int windowX = 0;
+        int windowY = 0;
+        int windowWidth = 0;
+        int windowHeight = 0;
+        SDL_GetWindowPosition(window, &windowX, &windowY);
+        SDL_GetWindowSize(window, &windowWidth, &windowHeight);
+
+        const int minX = std::max(0, windowX - captureX);
+        const int minY = std::max(0, windowY - captureY);
+        const int maxX = std::min(captureWidth, windowX - captureX + windowWidth);
+        const int maxY = std::min(captureHeight, windowY - captureY + windowHeight);
+        if (maxX <= minX || maxY <= minY)
+        {
+            return CaptureRegion{};
+        }
+        return CaptureRegion{minX, minY, maxX - minX, maxY - minY};
+    }
+
+    struct FrameStats
+    {
+        std::chrono::steady_clock::time_point windowStart = std::chrono::steady_clock::now();
+        std::uint64_t frames = 0;
+        std::uint64_t damagedPixels = 0;
+        std::uint64_t uploadedBytes = 0;
+        std::uint64_t uploadWaits = 0;
+        std::uint64_t droppedCaptures = 0;
+        std::uint64_t reusedCaptures = 0;
+        std::uint64_t lateCaptures = 0;
+        float renderScale = 1.0f;
+        size_t renderTargets = 0;
+        size_t renderTargetBytes = 0;
+    };
+
+    // Prints per-frame averages roughly once per second and starts a new window.
+    // Returns true when a line was printed and a new window started.
+    bool reportStats(FrameStats &stats, const std::string &captureBackend)
+    {
+        const auto now = std::chrono::steady_clock::now();
+        const double seconds = std::chrono::duration<double>(now - stats.windowStart).count();
+        if (seconds < 1.0 || stats.frames == 0)
+        {
+            return false;
+        }
+
+        const double frames = static_cast<double>(stats.frames);
+        std::cerr << "stats: fps=" << frames / seconds << " capture=" << captureBackend
+                  << " damaged_px/frame=" << static_cast<double>(stats.damagedPixels) / frames
+                  << " uploaded_bytes/frame=" << static_cast<double>(stats.uploadedBytes) / frames
+                  << " upload_fence_waits=" << stats.uploadWaits << " captures_dropped=" << stats.droppedCaptures
+                  << " captures_reused=" << stats.reusedCaptures << " captures_late=" << stats.lateCaptures
+                  << " render_scale=" << stats.renderScale << " render_targets=" << stats.renderTargets
+                  << " render_target_mib=" << static_cast<double>(stats.renderTargetBytes) / (1024.0 * 1024.0) << "\n";
+        stats = FrameStats{};
+        stats.windowStart = now;
+        return true;
+    }
+
+    constexpr size_t kTimingSamples = 240;
+    // GPU results are read this many frames after they were issued, by which point they are always available.
+    constexpr size_t kTimerFrames = 4;
+
+    // Rolling window of one stage's most recent durations, in milliseconds.
+    struct StageTimings
+    {
+        std::string name;
+        size_t capacity = kTimingSamples;
+        std::vector<float> samples;
+        size_t next = 0;
+    };
+
+    struct TimingSummary
+    {
+        double minimum = 0.0;
+        double average = 0.0;
+        double p50 = 0.0;
+        double p95 = 0.0;
+        double p99 = 0.0;
+    };
+
+    void recordTiming(StageTimings &stage, double milliseconds)
+    {
+        if (stage.samples.size() < stage.capacity)
+        {
+            stage.samples.push_back(static_cast<float>(milliseconds));
+            return;
+        }
+        stage.samples[stage.next] = static_cast<float>(milliseconds);
+        stage.next = (stage.next + 1) % stage.capacity;
+    }
+
+    TimingSummary summarizeTimings(const StageTimings &stage)
+    {
+        TimingSummary summary;
+        if (stage.samples.empty())
+        {
+            return summary;
+        }
+        std::vector<float> sorted = stage.samples;
+        std::sort(sorted.begin(), sorted.end());
+        double total = 0.0;
+        for (const float sample : sorted)
+        {
+            total += sample;
+        }
+        summary.minimum = sorted.front();
+        summary.average = total / static_cast<double>(sorted.size());
+        const auto percentile = [&sorted](size_t rank) {
+            return sorted[std::min(sorted.size() - 1, sorted.size() * rank / 100)];
+        };
+        summary.p50 = percentile(50);
+        summary.p95 = percentile(95);
+        summary.p99 = percentile(99);
+        return summary;
+    }
+
+    enum TimingStage : size_t
+    {
+        kCaptureStage,
+        kConvertStage,
+        kSwapStage,
+        kUploadGpuStage,
+        kFirstPassGpuStage
+    };
+
+    // CPU stages are recorded directly; GPU stages use a ring of GL_TIME_ELAPSED queries per frame.
+    struct PerfTimers
+    {
+        std::vector<StageTimings> stages;
+        std::array<std::vector<GLuint>, kTimerFrames> queries;
+        std::array<std::vector<bool>, kTimerFrames> issued;
+        size_t frame = 0;
+    };
+
+    PerfTimers createPerfTimers(const std::vector<std::string> &passNames, size_t samples = kTimingSamples)
+    {
+        PerfTimers timers;
+        for (const char *name : {"capture", "convert", "swap", "gpu_upload"})
+        {
+            timers.stages.push_back(StageTimings{name, samples, {}, 0});
+        }
+        for (const auto &name : passNames)
+        {
+            timers.stages.push_back(StageTimings{"gpu_" + name, samples, {}, 0});
+        }
+
+        const size_t gpuStages = timers.stages.size() - kUploadGpuStage;
+        for (size_t i = 0; i < kTimerFrames; ++i)
+        {
+            timers.queries[i].resize(gpuStages);
+            timers.issued[i].assign(gpuStages, false);
+            glGenQueries(static_cast<GLsizei>(gpuStages), timers.queries[i].data());
+        }
+        return timers;
+    }
+
+    void destroyPerfTimers(PerfTimers &timers)
+    {
+        for (auto &queries : timers.queries)
+        {
+            glDeleteQueries(static_cast<GLsizei>(queries.size()), queries.data());
+            queries.clear();
+        }
+    }
+
+    void recordCpuTiming(PerfTimers *timers, size_t stage, std::chrono::steady_clock::duration elapsed)
+    {
+        if (timers)
+        {
+            recordTiming(timers->stages[stage], std::chrono::duration<double, std::milli>(elapsed).count());
+        }
+    }
+
+    void beginGpuTiming(PerfTimers *timers, size_t stage)
+    {
+        if (timers)
+        {
+            const size_t query = stage - kUploadGpuStage;
+            glBeginQuery(GL_TIME_ELAPSED, timers->queries[timers->frame][query]);
+            timers->issued[timers->frame][query] = true;
+        }
+    }
+
+    void endGpuTiming(PerfTimers *timers)
+    {
+        if (timers)
+        {
+            glEndQuery(GL_TIME_ELAPSED);
+        }
+    }
+
+    // Moves to the next query set and harvests the results it still holds from kTimerFrames frames ago. Returns
+    // that frame's shader-pass GPU time in milliseconds (the part the render scale affects), or 0 unless every
+    // query issued that frame had its result available.
+    double advancePerfTimers(PerfTimers &timers)
+    {
+        double total = 0.0;
+        bool complete = true;
+        timers.frame = (timers.frame + 1) % kTimerFrames;
+        auto &queries = timers.queries[timers.frame];
+        auto &issued = timers.issued[timers.frame];
+        for (size_t i = 0; i < queries.size(); ++i)
+        {
+            if (!issued[i])
+            {
+                continue;
+            }
+            issued[i] = false;
+            GLint available = GL_FALSE;
+            glGetQueryObjectiv(queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available != GL_TRUE)
+            {
+                complete = false;
+                continue;
+            }
+            GLuint64 nanoseconds = 0;
+            glGetQueryObjectui64v(queries[i], GL_QUERY_RESULT, &nanoseconds);
+            const size_t stage = kUploadGpuStage + i;
+            recordTiming(timers.stages[stage], static_cast<double>(nanoseconds) / 1.0e6);
+            if (stage >= kFirstPassGpuStage)
+            {
+                total += static_cast<double>(nanoseconds) / 1.0e6;
+            }
+        }
+        return complete ? total : 0.0;
+    }
+
+    void reportTimings(const PerfTimers &timers)
+    {
+        std::cerr << std::fixed << std::setprecision(3) << "timings_ms(min/avg/p99):";
+        for (const auto &stage : timers.stages)
+        {
+            const TimingSummary summary = summarizeTimings(stage);
+            std::cerr << " " << stage.name << "=" << summary.minimum << "/" << summary.average << "/" << summary.p99;
+        }
+        std::cerr << std::defaultfloat << "\n";
+    }
+
+    // Scales the internal render resolution so GPU frame time stays within --frame-budget.
+    struct RenderGovernor
+    {
+        // Milliseconds; zero disables the governor.
+        double budget = 0.0;
+        float minScale = 0.5f;
+        float maxScale = 1.0f;
+        float scale = 1.0f;
+        double smoothed = 0.0;
+        int settleFrames = 0;
+    };
+
+    constexpr float kGovernorStep = 0.05f;
+    // Results arrive kTimerFrames late and are smoothed, so after a change the governor waits for them to
+    // reflect the new scale before judging it.
+    constexpr int kGovernorSettleFrames = 30;
+
+    // Feeds one frame's GPU time to the governor. It shrinks the scale as soon as the smoothed time exceeds the
+    // budget, but grows it only by one step and only when the predicted cost of that step stays under 85% of the
+    // budget. The gap between the two thresholds keeps it from oscillating.
+    void updateRenderGovernor(RenderGovernor &governor, double gpuMilliseconds)
+    {
+        if (governor.budget <= 0.0 || gpuMilliseconds <= 0.0)
+        {
+            return;
+        }
+        governor.smoothed =
+            governor.smoothed > 0.0 ? governor.smoothed * 0.9 + gpuMilliseconds * 0.1 : gpuMilliseconds;
+        if (governor.settleFrames > 0)
+        {
+            governor.settleFrames--;
+            return;
+        }
+
+        // GPU cost follows the pixel count, which grows with the square of the scale.
+        float target = governor.scale;
+        const float larger = governor.scale + kGovernorStep;
+        if (governor.smoothed > governor.budget)
+        {
+            const float exact = governor.scale * static_cast<float>(std::sqrt(governor.budget / governor.smoothed));
+            target = std::floor(exact / kGovernorStep + 1.0e-3f) * kGovernorStep;
+        }
+        else if (governor.smoothed * (larger * larger) / (governor.scale * governor.scale) < governor.budget * 0.85)
+        {
+            target = larger;
+        }
+        target = std::clamp(target, governor.minScale, governor.maxScale);
+        if (std::abs(target - governor.scale) < kGovernorStep * 0.5f)
+        {
+            return;
+        }
+        governor.smoothed *= static_cast<double>(target * target) / static_cast<double>(governor.scale * governor.scale);
+        governor.scale = target;
+        governor.settleFrames = kGovernorSettleFrames;
+    }
+
+    // Final pass of a reduced-resolution frame: a linear-filtered blit up to the full output size.
+    void upscaleTarget(const RenderTarget &source, GLuint framebuffer, int width, int height)
+    {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, source.framebuffer);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+        glBlitFramebuffer(0, 0, source.width, source.height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    // Stands in for the capture thread in benchmark mode: the test pattern as one full 32bpp frame, so every
+    // frame exercises the same upload and unpack path as a live capture.
+    CaptureSlot buildSyntheticSlot(const std::vector<std::uint8_t> &pattern, int width, int height)
+    {
+        CaptureSlot slot;
+        slot.captured = true;
+        CaptureFrame &frame = slot.frame;
+        frame.width = width;
+        frame.height = height;
+        frame.bitsPerPixel = 32;
+        frame.redMask = 0x0000FFul;
+        frame.greenMask = 0x00FF00ul;
+        frame.blueMask = 0xFF0000ul;
+        frame.rects.push_back(CaptureRect{0, 0, width, height, pattern.data(), width * 4});
+        frame.damagedPixels = static_cast<std::uint64_t>(width) * static_cast<std::uint64_t>(height);
+        frame.backend = "synthetic";
+        return slot;
+    }
+
+    std::string jsonString(std::string_view text)
+    {
+        std::string quoted = "\"";
+        for (const char c : text)
+        {
+            if (c == '"' || c == '\\')
+            {
+                quoted += '\\';
+            }
+            quoted += c;
+        }
+        return quoted + "\"";
+    }
+
+    void printBenchmarkReport(std::ostream &out, const Options &options, const std::vector<PassSettings> &passes,
+                              int frames, double seconds, const PerfTimers &timers)
+    {
+        out << std::fixed << std::setprecision(4) << "{\n  \"frames\": " << frames << ",\n  \"seconds\": " << seconds
+            << ",\n  \"fps\": " << static_cast<double>(frames) / seconds << ",\n  \"width\": " << options.width
+            << ",\n  \"height\": " << options.height << ",\n  \"shaders\": [";
+        for (size_t i = 0; i < passes.size(); ++i)
+        {
+            out << (i ? ", " : "") << jsonString(passes[i].path.empty() ? "built-in" : passes[i].path);
+        }
+        out << "],\n  \"stages_ms\": {";
+        for (size_t i = 0; i < timers.stages.size(); ++i)
+        {
+            const TimingSummary summary = summarizeTimings(timers.stages[i]);
+            out << (i ? "," : "") << "\n    " << jsonString(timers.stages[i].name) << ": {\"min\": " << summary.minimum
+                << ", \"avg\": " << summary.average << ", \"p50\": " << summary.p50 << ", \"p95\": " << summary.p95
+                << ", \"p99\": " << summary.p99 << "}";
+        }
+        out << "\n  }\n}\n" << std::defaultfloat;
+    }
+
+    // 5x7 glyphs, one byte per row with the leftmost pixel in bit 4. Lowercase letters use the uppercase glyphs.
+    constexpr std::string_view kHudGlyphs = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ.:/-_%()=";
+    constexpr std::array<std::array<std::uint8_t, 7>, 45> kHudFont = {{
+        {0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E}, {0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E},
+        {0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F}, {0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E},
+        {0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02}, {0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E},
+        {0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E}, {0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08},
+        {0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E}, {0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C},
+        {0x0E, 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11}, {0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E},
+        {0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E}, {0x1C, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1C},
+        {0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F}, {0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10},
+        {0x0E, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0F}, {0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11},
+        {0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E}, {0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C},
+        {0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11}, {0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F},
+        {0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11}, {0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11},
+        {0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E}, {0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10},
+        {0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D}, {0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11},
+        {0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E}, {0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04},
+        {0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E}, {0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04},
+        {0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0A}, {0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11},
+        {0x11, 0x11, 0x11, 0x0A, 0x04, 0x04, 0x04}, {0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F},
+        {0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C}, {0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00},
+        {0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00}, {0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00},
+        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1F}, {0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03},
+        {0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02}, {0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08},
+        {0x00, 0x00, 0x1F, 0x00, 0x1F, 0x00, 0x00},
+    }};
+    static_assert(kHudFont.size() == kHudGlyphs.size(), "kHudFont needs one glyph per kHudGlyphs character");
+
+    // Timing overlay: the text is rasterized on the CPU when the numbers change and drawn as one textured quad.
+    struct PerfHud
+    {
+        GLuint program = 0;
+        GLuint texture = 0;
+        int width = 0;
+        int height = 0;
+    };
+
+    PerfHud createPerfHud(ProgramCache &cache)
+    {
+        PerfHud hud;
+        hud.program = buildShaderProgram(std::string(kHudShader), cache, "HUD shader").program;
+        return hud;
+    }
+
+    void destroyPerfHud(PerfHud &hud)
+    {
+        if (hud.texture)
+        {
+            glDeleteTextures(1, &hud.texture);
+        }
+        if (hud.program)
+        {
+            glDeleteProgram(hud.program);
+        }
+        hud = PerfHud{};
+    }
+
+    void updatePerfHud(PerfHud &hud, const PerfTimers &timers)
+    {
+        std::vector<std::string> lines;
+        std::ostringstream header;
+        header << std::left << std::setw(24) << "stage" << std::right << std::setw(8) << "min" << std::setw(8) << "avg"
+               << std::setw(8) << "p99";
+        lines.push_back(header.str());
+        for (const auto &stage : timers.stages)
+        {
+            const TimingSummary summary = summarizeTimings(stage);
+            std::ostringstream line;
+            line << std::left << std::setw(24) << stage.name.substr(0, 23) << std::right << std::fixed
+                 << std::setprecision(2) << std::setw(8) << summary.minimum << std::setw(8) << summary.average
+                 << std::setw(8) << summary.p99;
+            lines.push_back(line.str());
+        }
+
+        // Each font pixel becomes a 2x2 block; cells are 6x9 font pixels with a 4 pixel border.
+        constexpr int kPixel = 2;
+        constexpr int kBorder = 4;
+        size_t columns = 0;
+        for (const auto &line : lines)
+        {
+            columns = std::max(columns, line.size());
+        }
+        const int width = static_cast<int>(columns) * 6 * kPixel + 2 * kBorder;
+        const int height = static_cast<int>(lines.size()) * 9 * kPixel + 2 * kBorder;
+        std::vector<std::uint8_t> pixels(static_cast<size_t>(width * height * 4));
+        for (size_t i = 0; i < pixels.size(); i += 4)
+        {
+            pixels[i + 3] = 160;
+        }
+
+        for (size_t row = 0; row < lines.size(); ++row)
+        {
+            for (size_t column = 0; column < lines[row].size(); ++column)
+            {
+                const char c = static_cast<char>(std::toupper(static_cast<unsigned char>(lines[row][column])));
+                const size_t glyph = kHudGlyphs.find(c);
+                if (glyph == std::string_view::npos)
+                {
+                    continue;
+                }
+                for (int gy = 0; gy < 7; ++gy)
+                {
+                    for (int gx = 0; gx < 5; ++gx)
+                    {
+                        if (!(kHudFont[glyph][static_cast<size_t>(gy)] & (0x10 >> gx)))
+                        {
+                            continue;
+                        }
+                        for (int py = 0; py < kPixel; ++py)
+                        {
+                            for (int px = 0; px < kPixel; ++px)
+                            {
+                                const int x = kBorder + (static_cast<int>(column) * 6 + gx) * kPixel + px;
+                                const int y = kBorder + (static_cast<int>(row) * 9 + gy) * kPixel + py;
+                                // Texture row 0 is drawn at the bottom of the quad.
+                                const size_t index = static_cast<size_t>(((height - 1 - y) * width + x) * 4);
+                                pixels[index] = pixels[index + 1] = pixels[index + 2] = pixels[index + 3] = 255;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        if (hud.texture && (hud.width != width || hud.height != height))
+        {
+            glDeleteTextures(1, &hud.texture);
+            hud.texture = 0;
+        }
+        if (!hud.texture)
+        {
+            hud.texture = createTexture(width, height, pixels);
+        }
+        else
+        {
+            glBindTexture(GL_TEXTURE_2D, hud.texture);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+            glBindTexture(GL_TEXTURE_2D, 0);
+        }
+        hud.width = width;
+        hud.height = height;
+    }
+
+    // Final pass over the window's top-left corner.
+    void drawPerfHud(const PerfHud &hud, GLuint vao, int windowWidth, int windowHeight)
+    {
+        if (!hud.texture)
+        {
+            return;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        // The HUD keeps its size and is clipped at the window edge rather than squashed into a narrow window.
+        glViewport(8, windowHeight - hud.height - 8, hud.width, hud.height);
+        glScissor(0, 0, windowWidth, windowHeight);
+        glEnable(GL_SCISSOR_TEST);
+        glUseProgram(hud.program);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, hud.texture);
+        glBindVertexArray(vao);
+        glDrawArrays(GL_TRIANGLES, 0, 6);
+        glDisable(GL_SCISSOR_TEST);
+        glBindVertexArray(0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glViewport(0, 0, windowWidth, windowHeight);
+    }
+
+    Options parseArgs(int argc, char **argv)
+    {
+        Options options;
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+            if (arg == "--shader" && i + 1 < argc)
+            {
+                PassSettings pass;
+                pass.path = argv[++i];
+                options.passes.push_back(std::move(pass));
+            }
+            else if (arg.rfind("--preset=", 0) == 0)
+            {
+                loadPresetFile(arg.substr(9), options);
+            }
+            else if (arg.rfind("--width=", 0) == 0)
+            {
+                options.width = std::stoi(arg.substr(8));
+            }
+            else if (arg.rfind("--height=", 0) == 0)
+            {
+                options.height = std::stoi(arg.substr(9));
+            }
+            else if (arg.rfind("--opacity=", 0) == 0)
+            {
+                options.opacity = std::stof(arg.substr(10));
+                if (options.opacity < 0.0f)
+                {
+                    options.opacity = 0.0f;
+                }
+                else if (options.opacity > 1.0f)
+                {
+                    options.opacity = 1.0f;
+                }
+            }
+            else if (arg.rfind("--upload-buffers=", 0) == 0)
+            {
+                options.uploadBuffers = std::max(0, std::stoi(arg.substr(17)));
+            }
+            else if (arg == "--capture-region=window" || arg == "--capture-region=desktop")
+            {
+                options.captureWindowRegion = arg == "--capture-region=window";
+            }
+            else if (arg.rfind("--capture-margin=", 0) == 0)
+            {
+                options.captureMargin = std::max(0, std::stoi(arg.substr(17)));
+            }
+            else if (arg == "--capture=cpu" || arg.rfind("--capture=composite", 0) == 0)
+            {
+                options.compositeCapture = arg != "--capture=cpu";
+                const size_t separator = arg.find(':');
+                options.compositeWindow =
+                    separator == std::string::npos ? 0 : std::stoul(arg.substr(separator + 1), nullptr, 0);
+            }
+            else if (arg.rfind("--monitor=", 0) == 0)
+            {
+                options.monitor = arg.substr(10);
+                if (options.monitor.empty())
+                {
+                    throw std::runtime_error("Expected --monitor=auto, an index or an output name");
+                }
+                if (std::all_of(options.monitor.begin(), options.monitor.end(),
+                                [](unsigned char c) { return std::isdigit(c); }))
+                {
+                    // Parsed here so the capture thread never sees a malformed selector.
+                    if (options.monitor.size() > 3)
+                    {
+                        throw std::runtime_error("Monitor index out of range: " + options.monitor);
+                    }
+                    options.monitorIndex = std::stoi(options.monitor);
+                }
+            }
+            else if (arg == "--damage=on" || arg == "--damage=off")
+            {
+                options.damage = arg == "--damage=on";
+            }
+            else if (arg == "--param" && i + 1 < argc)
+            {
+                const std::string assignment = argv[++i];
+                const size_t equals = assignment.find('=');
+                if (equals == std::string::npos)
+                {
+                    throw std::runtime_error("Expected --param NAME=VALUE, got: " + assignment);
+                }
+                options.parameters.values[assignment.substr(0, equals)] = std::stof(assignment.substr(equals + 1));
+            }
+            else if (arg.rfind("--params=", 0) == 0)
+            {
+                options.parameters.file = arg.substr(9);
+                loadParameterFile(options.parameters.file, options.parameters);
+            }
+            else if (arg == "--live-param" && i + 1 < argc)
+            {
+                options.parameters.live.insert(argv[++i]);
+            }
+            else if (arg == "--no-shader-cache")
+            {
+                options.shaderCache = false;
+            }
+            else if (arg == "--list-params")
+            {
+                options.listParameters = true;
+            }
+            else if (arg == "--stats")
+            {
+                options.stats = true;
+            }
+            else if (arg == "--hud")
+            {
+                options.hud = true;
+            }
+            else if (arg.rfind("--capture-fps=", 0) == 0)
+            {
+                options.captureFps = std::max(0.0f, std::stof(arg.substr(14)));
+            }
+            else if (arg.rfind("--max-fps=", 0) == 0)
+            {
+                options.maxFps = std::max(0.0f, std::stof(arg.substr(10)));
+            }
+            else if (arg == "--vsync=on" || arg == "--vsync=off" || arg == "--vsync=adaptive")
+            {
+                options.swapInterval = arg == "--vsync=on" ? 1 : arg == "--vsync=off" ? 0 : -1;
+            }
+            else if (arg.rfind("--frame-budget=", 0) == 0)
+            {
+                options.frameBudget = std::max(0.0f, std::stof(arg.substr(15)));
+            }
+            else if (arg.rfind("--render-scale=", 0) == 0)
+            {
+                const std::string range = arg.substr(15);
+                const size_t separator = range.find(':');
+                if (separator == std::string::npos)
+                {
+                    throw std::runtime_error("Expected --render-scale=MIN:MAX, got: " + range);
+                }
+                options.minRenderScale = std::clamp(std::stof(range.substr(0, separator)), 0.1f, 1.0f);
+                options.maxRenderScale =
+                    std::clamp(std::stof(range.substr(separator + 1)), options.minRenderScale, 1.0f);
+            }
+            else if (arg.rfind("--source=", 0) == 0)
+            {
+                static const std::map<std::string, SourceKind> kinds = {
+                    {"desktop", SourceKind::Desktop}, {"pattern", SourceKind::Pattern}, {"gradient", SourceKind::Gradient},
+                    {"text", SourceKind::Text},       {"noise", SourceKind::Noise},     {"damage", SourceKind::Damage}};
+                const auto kind = kinds.find(arg.substr(9));
+                if (kind == kinds.end())
+                {
+                    throw std::runtime_error("Unknown source: " + arg.substr(9));
+                }
+                options.source = kind->second;
+            }
+            else if (arg.rfind("--record=", 0) == 0)
+            {
+                options.recordPath = arg.substr(9);
+            }
+            else if (arg.rfind("--replay=", 0) == 0)
+            {
+                options.replayPath = arg.substr(9);
+                options.source = SourceKind::Replay;
+            }
+            else if (arg.rfind("--filter=", 0) == 0)
+            {
+                options.filterInput = arg.substr(9);
+                options.source = SourceKind::Filter;
+            }
+            else if (arg == "--replay-rate=original" || arg == "--replay-rate=max")
+            {
+                options.replayRealtime = arg == "--replay-rate=original";
+            }
+            else if (arg.rfind("--source-size=", 0) == 0)
+            {
+                const std::string size = arg.substr(14);
+                const size_t separator = size.find('x');
+                if (separator == std::string::npos)
+                {
+                    throw std::runtime_error("Expected --source-size=WIDTHxHEIGHT, got: " + size);
+                }
+                // Capped at 8K UHD.
+                options.sourceWidth = std::clamp(std::stoi(size.substr(0, separator)), 1, 7680);
+                options.sourceHeight = std::clamp(std::stoi(size.substr(separator + 1)), 1, 4320);
+            }
+            else if (arg.rfind("--benchmark=", 0) == 0)
+            {
+                options.benchmarkFrames = std::max(1, std::stoi(arg.substr(12)));
+            }
+            else
+            {
+                std::cerr << "Unrecognized argument: " << arg << "\n";
+            }
+        }
+        if (options.source == SourceKind::Filter && options.benchmarkFrames > 0)
+        {
+            // Both own stdout.
+            throw std::runtime_error("--filter and --benchmark cannot be combined");
+        }
+        return options;
+    }
+
+    // An image decoded to RGBA8, top row first like the captured desktop.
+    struct DecodedImage
+    {
+        int width = 0;
+        int height = 0;
+        std::vector<std::uint8_t> pixels;
+    };
+
+#if CRT_HAS_PNG
+    DecodedImage decodePng(const std::string &path)
+    {
+        png_image image;
+        std::memset(&image, 0, sizeof(image));
+        image.version = PNG_IMAGE_VERSION;
+        if (!png_image_begin_read_from_file(&image, path.c_str()))
+        {
+            throw std::runtime_error(image.message);
+        }
+        image.format = PNG_FORMAT_RGBA;
+        DecodedImage decoded;
+        decoded.width = static_cast<int>(image.width);
+        decoded.height = static_cast<int>(image.height);
+        decoded.pixels.resize(PNG_IMAGE_SIZE(image));
+        if (!png_image_finish_read(&image, nullptr, decoded.pixels.data(), 0, nullptr))
+        {
+            const std::string message = image.message;
+            png_image_free(&image);
+            throw std::runtime_error(message);
+        }
+        return decoded;
+    }
+#endif
+
+    // Raw Netpbm images with 8-bit samples: PPM (P6), or PAM (P7) with one to four channels.
+    DecodedImage decodeNetpbm(std::istream &stream)
+    {
+        std::string magic;
+        stream >> magic;
+        int width = 0;
+        int height = 0;
+        int depth = 3;
+        int maxValue = 0;
+        if (magic == "P6")
+        {
+            const auto field = [&stream]() {
+                stream >> std::ws;
+                while (stream.peek() == '#')
+                {
+                    stream.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+                    stream >> std::ws;
+                }
+                int value = 0;
+                stream >> value;
+                return value;
+            };
+            width = field();
+            height = field();
+            maxValue = field();
+        }
+        else if (magic == "P7")
+        {
+            std::string key;
+            while (stream >> key && key != "ENDHDR")
+            {
+                if (key == "WIDTH")
+                {
+                    stream >> width;
+                }
+                else if (key == "HEIGHT")
+                {
+                    stream >> height;
+                }
+                else if (key == "DEPTH")
+                {
+                    stream >> depth;
+                }
+                else if (key == "MAXVAL")
+                {
+                    stream >> maxValue;
+                }
+                else
+                {
+                    // TUPLTYPE and comments.
+                    stream.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+                }
+            }
+        }
+        else
+        {
+            throw std::runtime_error("not a PNG, PPM (P6) or PAM (P7) image");
+        }
+        // A single whitespace character separates the header from the samples.
+        stream.get();
+        if (!stream || width <= 0 || height <= 0 || depth < 1 || depth > 4 || maxValue != 255)
+        {
+            throw std::runtime_error("unsupported image header; only 8-bit samples are read");
+        }
+
+        const size_t pixelCount = static_cast<size_t>(width) * static_cast<size_t>(height);
+        std::vector<std::uint8_t> samples(pixelCount * static_cast<size_t>(depth));
+        if (!stream.read(reinterpret_cast<char *>(samples.data()), static_cast<std::streamsize>(samples.size())))
+        {
+            throw std::runtime_error("image data is truncated");
+        }
+
+        DecodedImage decoded;
+        decoded.width = width;
+        decoded.height = height;
+        decoded.pixels.resize(pixelCount * 4);
+        for (size_t i = 0; i < pixelCount; ++i)
+        {
+            const std::uint8_t *in = samples.data() + i * static_cast<size_t>(depth);
+            std::uint8_t *out = decoded.pixels.data() + i * 4;
+            const bool color = depth >= 3;
+            out[0] = in[0];
+            out[1] = color ? in[1] : in[0];
+            out[2] = color ? in[2] : in[0];
+            out[3] = depth == 2 ? in[1] : depth == 4 ? in[3] : 0xff;
+        }
+        return decoded;
+    }
+
+    DecodedImage decodeImage(const std::string &path)
+    {
+        std::ifstream stream(path, std::ios::in | std::ios::binary);
+        if (!stream)
+        {
+            throw std::runtime_error("cannot open file");
+        }
+        constexpr std::array<char, 4> pngSignature = {'\x89', 'P', 'N', 'G'};
+        std::array<char, 4> signature{};
+        stream.read(signature.data(), signature.size());
+        if (stream && signature == pngSignature)
+        {
+#if CRT_HAS_PNG
+            return decodePng(path);
+#else
+            throw std::runtime_error("PNG support was not compiled in (libpng missing)");
+#endif
+        }
+        stream.clear();
+        stream.seekg(0);
+        return decodeNetpbm(stream);
+    }
+
+    // Lookup textures for every pass. Each file becomes one GL texture, shared by all passes and names that refer
+    // to it; per-binding filtering and wrapping live in sampler objects. Files are decoded on a worker thread and
+    // uploaded at most kUploadBytesPerFrame per frame, so a large overlay never stalls the render loop; until a
+    // texture is complete a transparent 1x1 placeholder is bound in its place.
+    class LookupTextureCache
+    {
+    public:
+        static constexpr size_t kUploadBytesPerFrame = 4u << 20;
+
+        explicit LookupTextureCache(std::vector<LookupTextureSpec> presetTextures)
+            : presetTextures_(std::move(presetTextures))
+        {
+            placeholder_ = createTexture(1, 1, std::vector<std::uint8_t>(4, 0));
+            thread_ = std::thread([this] { run(); });
+        }
+
+        ~LookupTextureCache()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stopping_ = true;
+            }
+            wake_.notify_one();
+            thread_.join();
+            for (const auto &image : images_)
+            {
+                glDeleteTextures(1, &image.texture);
+            }
+            for (const auto &binding : bindings_)
+            {
+                glDeleteSamplers(1, &binding.sampler);
             }
+            glDeleteTextures(1, &placeholder_);
+        }
 
-            XWindowAttributes attrs;
-            if (XGetWindowAttributes(display_, root_, &attrs) == 0)
+        LookupTextureCache(const LookupTextureCache &) = delete;
+        LookupTextureCache &operator=(const LookupTextureCache &) = delete;
+
+        // The binding for sampler `name`: the shader's own `#pragma texture` wins over the preset's. The file is
+        // queued for decoding the first time anything refers to it. Returns -1 when nothing declares `name`.
+        int resolve(const std::string &name, const std::vector<LookupTextureSpec> &declared)
+        {
+            const auto named = [&name](const LookupTextureSpec &spec) { return spec.name == name; };
+            auto spec = std::find_if(declared.begin(), declared.end(), named);
+            if (spec == declared.end())
             {
-                return false;
+                spec = std::find_if(presetTextures_.begin(), presetTextures_.end(), named);
+                if (spec == presetTextures_.end())
+                {
+                    return -1;
+                }
             }
 
-            width = attrs.width;
-            height = attrs.height;
+            auto image = std::find_if(images_.begin(), images_.end(),
+                                      [&spec](const Image &entry) { return entry.path == spec->path; });
+            if (image == images_.end())
+            {
+                images_.emplace_back();
+                images_.back().path = spec->path;
+                image = std::prev(images_.end());
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    paths_.push_back(spec->path);
+                    jobs_.push_back(images_.size() - 1);
+                }
+                wake_.notify_one();
+            }
+            const size_t imageIndex = static_cast<size_t>(image - images_.begin());
+            if (spec->mipmap && !image->mipmap)
+            {
+                image->mipmap = true;
+                if (image->ready)
+                {
+                    glBindTexture(GL_TEXTURE_2D, image->texture);
+                    glGenerateMipmap(GL_TEXTURE_2D);
+                    glBindTexture(GL_TEXTURE_2D, 0);
+                }
+            }
 
-            releaseImage();
-            image_ = XGetImage(display_, root_, 0, 0, static_cast<unsigned int>(width), static_cast<unsigned int>(height),
-                               AllPlanes, ZPixmap);
-            if (!image_ || (image_->bits_per_pixel != 32 && image_->bits_per_pixel != 24))
+            const auto binding = std::find_if(bindings_.begin(), bindings_.end(), [&](const Binding &entry) {
+                return entry.image == imageIndex && entry.linear == spec->linear && entry.mipmap == spec->mipmap &&
+                       entry.wrap == spec->wrap;
+            });
+            if (binding != bindings_.end())
             {
-                releaseImage();
-                return false;
+                return static_cast<int>(binding - bindings_.begin());
+            }
+            bindings_.push_back(Binding{imageIndex, spec->linear, spec->mipmap, spec->wrap,
+                                        createSampler(spec->linear, spec->mipmap, spec->wrap)});
+            return static_cast<int>(bindings_.size() - 1);
+        }
+
+        // Takes the worker's decoded images and uploads up to kUploadBytesPerFrame of their rows. Called once per
+        // frame.
+        void update()
+        {
+            std::vector<Decoded> finished;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                finished.swap(decoded_);
+            }
+            for (auto &result : finished)
+            {
+                Image &image = images_[result.image];
+                if (!result.error.empty())
+                {
+                    std::cerr << "Failed to load lookup texture " << image.path << ": " << result.error << "\n";
+                    continue;
+                }
+                image.pixels = std::move(result.decoded);
+                image.texture = createTexture(image.pixels.width, image.pixels.height, {});
+                uploads_.push_back(result.image);
             }
 
-            buffer.resize(static_cast<size_t>(width * height * 4));
-            const int bytesPerPixel = image_->bits_per_pixel / 8;
-            for (int y = 0; y < height; ++y)
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            size_t budget = kUploadBytesPerFrame;
+            while (!uploads_.empty() && budget > 0)
             {
-                const unsigned char *row = reinterpret_cast<const unsigned char *>(image_->data + y * image_->bytes_per_line);
-                for (int x = 0; x < width; ++x)
+                Image &image = images_[uploads_.front()];
+                const size_t rowBytes = static_cast<size_t>(image.pixels.width) * 4;
+                const int rows = std::clamp(static_cast<int>(budget / rowBytes), 1,
+                                            image.pixels.height - image.uploadedRows);
+                glBindTexture(GL_TEXTURE_2D, image.texture);
+                glTexSubImage2D(GL_TEXTURE_2D, 0, 0, image.uploadedRows, image.pixels.width, rows, GL_RGBA,
+                                GL_UNSIGNED_BYTE,
+                                image.pixels.pixels.data() + rowBytes * static_cast<size_t>(image.uploadedRows));
+                image.uploadedRows += rows;
+                budget -= std::min(budget, rowBytes * static_cast<size_t>(rows));
+                if (image.uploadedRows < image.pixels.height)
                 {
-                    const unsigned long pixel = *reinterpret_cast<const unsigned long *>(row + static_cast<size_t>(x * bytesPerPixel));
-                    const float r = normalizeChannel(pixel, image_->red_mask);
-                    const float g = normalizeChannel(pixel, image_->green_mask);
-                    const float b = normalizeChannel(pixel, image_->blue_mask);
+                    continue;
+                }
 
-                    const size_t idx = static_cast<size_t>((y * width + x) * 4);
-                    buffer[idx + 0] = static_cast<std::uint8_t>(r * 255.0f);
-                    buffer[idx + 1] = static_cast<std::uint8_t>(g * 255.0f);
-                    buffer[idx + 2] = static_cast<std::uint8_t>(b * 255.0f);
-                    buffer[idx + 3] = 255;
+                if (image.mipmap)
+                {
+                    glGenerateMipmap(GL_TEXTURE_2D);
                 }
+                image.ready = true;
+                std::cerr << "Loaded lookup texture " << image.path << " (" << image.pixels.width << "x"
+                          << image.pixels.height << ")\n";
+                image.pixels.pixels = std::vector<std::uint8_t>();
+                uploads_.pop_front();
+            }
+            glBindTexture(GL_TEXTURE_2D, 0);
+        }
+
+        GLuint texture(int binding) const
+        {
+            if (binding < 0)
+            {
+                return placeholder_;
             }
+            const Image &image = images_[bindings_[static_cast<size_t>(binding)].image];
+            return image.ready ? image.texture : placeholder_;
+        }
 
-            return true;
+        GLuint sampler(int binding) const
+        {
+            return binding < 0 ? 0 : bindings_[static_cast<size_t>(binding)].sampler;
         }
 
     private:
-        void releaseImage()
+        struct Image
+        {
+            std::string path;
+            bool mipmap = false;
+            GLuint texture = 0;
+            // Decoded rows waiting for upload; released once the texture is complete.
+            DecodedImage pixels;
+            int uploadedRows = 0;
+            bool ready = false;
+        };
+
+        struct Binding
+        {
+            size_t image = 0;
+            bool linear = true;
+            bool mipmap = false;
+            LookupWrap wrap = LookupWrap::ClampToEdge;
+            GLuint sampler = 0;
+        };
+
+        struct Decoded
+        {
+            size_t image = 0;
+            DecodedImage decoded;
+            std::string error;
+        };
+
+        static GLuint createSampler(bool linear, bool mipmap, LookupWrap wrap)
         {
-            if (image_)
+            GLuint sampler = 0;
+            glGenSamplers(1, &sampler);
+            const GLint magnify = linear ? GL_LINEAR : GL_NEAREST;
+            const GLint minify = !mipmap ? magnify : linear ? GL_LINEAR_MIPMAP_LINEAR : GL_NEAREST_MIPMAP_NEAREST;
+            const GLint mode = wrap == LookupWrap::Repeat           ? GL_REPEAT
+                               : wrap == LookupWrap::MirroredRepeat ? GL_MIRRORED_REPEAT
+                               : wrap == LookupWrap::ClampToBorder  ? GL_CLAMP_TO_BORDER
+                                                                    : GL_CLAMP_TO_EDGE;
+            glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, minify);
+            glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, magnify);
+            glSamplerParameteri(sampler, GL_TEXTURE_WRAP_S, mode);
+            glSamplerParameteri(sampler, GL_TEXTURE_WRAP_T, mode);
+            return sampler;
+        }
+
+        void run()
+        {
+            for (;;)
             {
-                image_->data = nullptr;
-                XDestroyImage(image_);
-                image_ = nullptr;
+                Decoded result;
+                std::string path;
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    wake_.wait(lock, [this] { return stopping_ || !jobs_.empty(); });
+                    if (stopping_)
+                    {
+                        return;
+                    }
+                    result.image = jobs_.front();
+                    jobs_.pop_front();
+                    path = paths_[result.image];
+                }
+                try
+                {
+                    result.decoded = decodeImage(path);
+                }
+                catch (const std::exception &error)
+                {
+                    result.error = error.what();
+                }
+                std::lock_guard<std::mutex> lock(mutex_);
+                decoded_.push_back(std::move(result));
             }
         }
 
-        Display *display_ = nullptr;
-        Window root_ = 0;
-        XImage *image_ = nullptr;
+        std::vector<LookupTextureSpec> presetTextures_;
+        std::vector<Image> images_;
+        std::vector<Binding> bindings_;
+        std::deque<size_t> uploads_;
+        GLuint placeholder_ = 0;
+
+        // Shared with the worker thread.
+        std::mutex mutex_;
+        std::condition_variable wake_;
+        std::deque<size_t> jobs_;
+        std::vector<std::string> paths_;
+        std::vector<Decoded> decoded_;
+        bool stopping_ = false;
+        std::thread thread_;
     };
-#else
-    class ScreenCapture
+
+    // Gives every sampler the shader uses besides Texture, history and feedback a texture unit after theirs and
+    // resolves it against the lookup textures.
+    void attachLookupTextures(ShaderProgram &program, LookupTextureCache &lookups)
     {
-    public:
-        bool grab(std::vector<std::uint8_t> &, int &, int &)
+        static const std::regex builtIn(R"re(Texture|PrevTexture|Prev[1-6]Texture|PassFeedback\d+)re");
+
+        GLint nextUnit = 1;
+        for (const GLint unit : program.historyUnits)
         {
-            return false;
+            nextUnit = std::max(nextUnit, unit + 1);
+        }
+        for (const GLint unit : program.feedbackUnits)
+        {
+            nextUnit = std::max(nextUnit, unit + 1);
         }
-    };
-#endif
 
-    ExclusionRect buildExclusionRect(SDL_Window *window, int captureWidth, int captureHeight)
+        GLint uniformCount = 0;
+        glGetProgramiv(program.program, GL_ACTIVE_UNIFORMS, &uniformCount);
+        program.lookups.clear();
+        glUseProgram(program.program);
+        for (GLint index = 0; index < uniformCount; ++index)
+        {
+            std::array<GLchar, 256> buffer{};
+            GLsizei length = 0;
+            GLint size = 0;
+            GLenum type = 0;
+            glGetActiveUniform(program.program, static_cast<GLuint>(index), static_cast<GLsizei>(buffer.size()),
+                               &length, &size, &type, buffer.data());
+            const std::string name(buffer.data(), static_cast<size_t>(std::max(0, length)));
+            if (type != GL_SAMPLER_2D || std::regex_match(name, builtIn))
+            {
+                continue;
+            }
+
+            LookupSampler sampler;
+            sampler.name = name;
+            sampler.unit = nextUnit++;
+            sampler.binding = lookups.resolve(name, program.declaredTextures);
+            if (sampler.binding < 0)
+            {
+                std::cerr << "No lookup texture declared for sampler " << name << "; it reads as transparent\n";
+            }
+            glUniform1i(glGetUniformLocation(program.program, name.c_str()), sampler.unit);
+            program.lookups.push_back(sampler);
+        }
+        glUseProgram(0);
+    }
+
+    std::vector<ShaderProgram> buildPipeline(const Options &options, ProgramCache &cache)
     {
-        ExclusionRect rect;
-        if (!window || captureWidth <= 0 || captureHeight <= 0)
+        std::vector<ShaderProgram> pipeline;
+        if (options.passes.empty())
         {
-            return rect;
+            pipeline.emplace_back(buildShaderProgram(std::string(kDefaultShader), cache, "built-in shader"));
+            return pipeline;
         }
 
-        int windowX = 0;
-        int windowY = 0;
-        SDL_GetWindowPosition(window, &windowX, &windowY);
+        // Every pass is submitted before any status is queried, so the driver can compile them side by side.
+        std::vector<PendingProgram> pending;
+        pending.reserve(options.passes.size());
+        try
+        {
+            for (const auto &pass : options.passes)
+            {
+                pending.emplace_back(submitShaderFile(pass.path, options.parameters, cache));
+            }
 
-        int windowWidth = 0;
-        int windowHeight = 0;
-        SDL_GetWindowSize(window, &windowWidth, &windowHeight);
+            pipeline.reserve(pending.size());
+            for (auto &pass : pending)
+            {
+                pipeline.emplace_back(finishShaderProgram(pass));
+            }
+        }
+        catch (...)
+        {
+            for (auto &pass : pending)
+            {
+                destroyPendingProgram(pass);
+            }
+            for (auto &program : pipeline)
+            {
+                glDeleteProgram(program.program);
+            }
+            throw;
+        }
+
+        for (size_t i = 0; i < pipeline.size(); ++i)
+        {
+            if (options.listParameters)
+            {
+                const std::string &path = options.passes[i].path;
+                for (const auto &parameter : pipeline[i].parameters)
+                {
+                    std::cerr << path << ": " << parameter.name << " = " << parameter.value << " ["
+                              << parameter.minimum << ", " << parameter.maximum << "] "
+                              << (parameter.live ? "live" : "constant") << "  " << parameter.description << "\n";
+                }
+            }
+        }
+        return pipeline;
+    }
 
-        const float minX = static_cast<float>(windowX) / static_cast<float>(captureWidth);
-        const float minY = static_cast<float>(windowY) / static_cast<float>(captureHeight);
-        const float maxX = static_cast<float>(windowX + windowWidth) / static_cast<float>(captureWidth);
-        const float maxY = static_cast<float>(windowY + windowHeight) / static_cast<float>(captureHeight);
+    // Watches the directories of every pass file; editors usually save by renaming over the file, which a
+    // watch on the file itself would lose.
+    struct ShaderWatcher
+    {
+        int fd = -1;
+        std::vector<int> passWatches;
+        std::vector<std::string> passNames;
+        int parameterWatch = -1;
+        std::string parameterName;
+        // Set by pollShaderWatcher when the --params file changed; the caller clears it.
+        bool parametersChanged = false;
+    };
 
-        if (maxX <= 0.0f || maxY <= 0.0f || minX >= 1.0f || minY >= 1.0f)
+    // Shader and parameter files are watched through their directories, because editors often replace a file
+    // rather than write it in place.
+    ShaderWatcher createShaderWatcher(const std::vector<PassSettings> &passes, const std::string &parameterFile)
+    {
+        ShaderWatcher watcher;
+#if CRT_HAS_INOTIFY
+        watcher.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (watcher.fd < 0)
+        {
+            std::cerr << "Shader hot reload unavailable: inotify_init1 failed\n";
+            return watcher;
+        }
+        const auto watchDirectory = [&watcher](const std::filesystem::path &path) {
+            const std::filesystem::path directory = path.has_parent_path() ? path.parent_path() : ".";
+            return inotify_add_watch(watcher.fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+        };
+        for (const auto &pass : passes)
+        {
+            const std::filesystem::path path(pass.path);
+            watcher.passWatches.push_back(pass.path.empty() ? -1 : watchDirectory(path));
+            watcher.passNames.push_back(path.filename().string());
+        }
+        if (!parameterFile.empty())
         {
-            return rect;
+            const std::filesystem::path path(parameterFile);
+            watcher.parameterWatch = watchDirectory(path);
+            watcher.parameterName = path.filename().string();
         }
+#else
+        (void)passes;
+        (void)parameterFile;
+#endif
+        return watcher;
+    }
 
-        rect.x = std::max(0.0f, minX);
-        rect.y = std::max(0.0f, minY);
-        rect.width = std::min(1.0f, maxX) - rect.x;
-        rect.height = std::min(1.0f, maxY) - rect.y;
-        rect.valid = rect.width > 0.0f && rect.height > 0.0f;
-        return rect;
+    void destroyShaderWatcher(ShaderWatcher &watcher)
+    {
+#if CRT_HAS_INOTIFY
+        if (watcher.fd >= 0)
+        {
+            close(watcher.fd);
+        }
+#endif
+        watcher = ShaderWatcher{};
     }
 
-    Options parseArgs(int argc, char **argv)
+    // Drains pending events without blocking and returns the indices of passes whose file changed.
+    std::vector<size_t> pollShaderWatcher(ShaderWatcher &watcher)
     {
-        Options options;
-        for (int i = 1; i < argc; ++i)
+        std::vector<size_t> changed;
+#if CRT_HAS_INOTIFY
+        if (watcher.fd < 0)
         {
-            std::string arg = argv[i];
-            if (arg == "--shader" && i + 1 < argc)
+            return changed;
+        }
+        alignas(inotify_event) char buffer[4096];
+        ssize_t length = 0;
+        while ((length = read(watcher.fd, buffer, sizeof(buffer))) > 0)
+        {
+            for (ssize_t offset = 0; offset < length;)
             {
-                options.shaderPaths.emplace_back(argv[++i]);
+                const auto *event = reinterpret_cast<const inotify_event *>(buffer + offset);
+                const std::string_view name = event->len ? std::string_view(event->name) : std::string_view();
+                for (size_t i = 0; i < watcher.passWatches.size(); ++i)
+                {
+                    if (watcher.passWatches[i] == event->wd && watcher.passNames[i] == name &&
+                        std::find(changed.begin(), changed.end(), i) == changed.end())
+                    {
+                        changed.push_back(i);
+                    }
+                }
+                if (watcher.parameterWatch >= 0 && watcher.parameterWatch == event->wd &&
+                    watcher.parameterName == name)
+                {
+                    watcher.parametersChanged = true;
+                }
+                offset += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
             }
-            else if (arg.rfind("--width=", 0) == 0)
+        }
+#else
+        (void)watcher;
+#endif
+        return changed;
+    }
+
+    // Compiles hot reloads off the render thread when the driver lacks parallel shader compile: a worker with its
+    // own GL context, sharing objects with the render context, builds each program and hands back its id.
+    class ShaderCompileThread
+    {
+    public:
+        struct Result
+        {
+            size_t pass = 0;
+            std::optional<ShaderProgram> program;
+            std::string error;
+        };
+
+        // Called with the render context current, which is current again on return. Throws when no shared
+        // context can be created.
+        ShaderCompileThread(SDL_Window *window, SDL_GLContext renderContext, const ProgramCache &cache)
+            : window_(window), cache_(cache)
+        {
+            SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 1);
+            context_ = SDL_GL_CreateContext(window);
+            SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 0);
+            SDL_GL_MakeCurrent(window, renderContext);
+            sdlCheck(context_ != nullptr, "Cannot create a shared GL context for shader compiles");
+            thread_ = std::thread([this] { run(); });
+        }
+
+        ~ShaderCompileThread()
+        {
             {
-                options.width = std::stoi(arg.substr(8));
+                std::lock_guard<std::mutex> lock(mutex_);
+                stopping_ = true;
             }
-            else if (arg.rfind("--height=", 0) == 0)
+            wake_.notify_one();
+            thread_.join();
+            for (const auto &result : results_)
             {
-                options.height = std::stoi(arg.substr(9));
+                if (result.program)
+                {
+                    glDeleteProgram(result.program->program);
+                }
             }
-            else if (arg.rfind("--opacity=", 0) == 0)
+            SDL_GL_DeleteContext(context_);
+        }
+
+        ShaderCompileThread(const ShaderCompileThread &) = delete;
+        ShaderCompileThread &operator=(const ShaderCompileThread &) = delete;
+
+        // Queues a rebuild of `pass`; a queued rebuild of the same pass that has not started yet is superseded.
+        void submit(size_t pass, const std::string &path, const ParameterSettings &parameters)
+        {
             {
-                options.opacity = std::stof(arg.substr(10));
-                if (options.opacity < 0.0f)
+                std::lock_guard<std::mutex> lock(mutex_);
+                const auto superseded = [pass](const Job &job) { return job.pass == pass; };
+                jobs_.erase(std::remove_if(jobs_.begin(), jobs_.end(), superseded), jobs_.end());
+                jobs_.push_back(Job{pass, path, parameters});
+            }
+            wake_.notify_one();
+        }
+
+        // Finished programs, in completion order. Called once per frame.
+        std::vector<Result> take()
+        {
+            std::vector<Result> finished;
+            std::lock_guard<std::mutex> lock(mutex_);
+            finished.swap(results_);
+            return finished;
+        }
+
+    private:
+        struct Job
+        {
+            size_t pass = 0;
+            std::string path;
+            ParameterSettings parameters;
+        };
+
+        void run()
+        {
+            SDL_GL_MakeCurrent(window_, context_);
+            for (;;)
+            {
+                Job job;
                 {
-                    options.opacity = 0.0f;
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    wake_.wait(lock, [this] { return stopping_ || !jobs_.empty(); });
+                    if (stopping_)
+                    {
+                        break;
+                    }
+                    job = std::move(jobs_.front());
+                    jobs_.pop_front();
                 }
-                else if (options.opacity > 1.0f)
+
+                Result result;
+                result.pass = job.pass;
+                try
                 {
-                    options.opacity = 1.0f;
+                    PendingProgram pending = submitShaderFile(job.path, job.parameters, cache_);
+                    result.program = finishShaderProgram(pending);
+                    // The render context may only use the program once this context's commands have completed.
+                    glFinish();
                 }
+                catch (const std::exception &error)
+                {
+                    result.error = error.what();
+                }
+                std::lock_guard<std::mutex> lock(mutex_);
+                results_.push_back(std::move(result));
             }
-            else
+            SDL_GL_MakeCurrent(window_, nullptr);
+        }
+
+        SDL_Window *window_ = nullptr;
+        SDL_GLContext context_ = nullptr;
+        // A copy, so the worker never touches the render thread's hit and miss counts.
+        ProgramCache cache_;
+
+        // Shared with the worker thread.
+        std::mutex mutex_;
+        std::condition_variable wake_;
+        std::deque<Job> jobs_;
+        std::vector<Result> results_;
+        bool stopping_ = false;
+        std::thread thread_;
+    };
+
+    struct ShaderReload
+    {
+        bool scheduled = false;
+        std::chrono::steady_clock::time_point due;
+        std::optional<PendingProgram> pending;
+    };
+
+    void installReload(ShaderProgram &slot, ShaderProgram program, LookupTextureCache &lookups, const std::string &path)
+    {
+        attachLookupTextures(program, lookups);
+        glDeleteProgram(slot.program);
+        slot = std::move(program);
+        std::cerr << "Reloaded " << path << "\n";
+    }
+
+    // Advances hot reloads by one frame. A changed file is submitted once its writes have settled, and the new
+    // program replaces the old one only after it linked, so the render loop never waits on a compile. With
+    // parallel compile the driver builds it in the background and GL_COMPLETION_STATUS_KHR says when it is done;
+    // otherwise `compiler` builds it on its own context. Without either, the status is read one frame after
+    // submission.
+    void updateShaderReloads(std::vector<ShaderProgram> &pipeline,
+                             const std::vector<PassSettings> &passes,
+                             std::vector<ShaderReload> &reloads,
+                             const ParameterSettings &parameters,
+                             ProgramCache &cache,
+                             LookupTextureCache &lookups,
+                             bool parallelCompile,
+                             ShaderCompileThread *compiler)
+    {
+        if (compiler)
+        {
+            for (auto &result : compiler->take())
             {
-                std::cerr << "Unrecognized argument: " << arg << "\n";
+                if (result.program)
+                {
+                    installReload(pipeline[result.pass], std::move(*result.program), lookups, passes[result.pass].path);
+                }
+                else
+                {
+                    std::cerr << "Shader reload failed, keeping the previous program: " << result.error << "\n";
+                }
             }
         }
-        return options;
+
+        const auto now = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < reloads.size(); ++i)
+        {
+            ShaderReload &reload = reloads[i];
+            if (reload.scheduled && now >= reload.due)
+            {
+                reload.scheduled = false;
+                if (compiler)
+                {
+                    compiler->submit(i, passes[i].path, parameters);
+                    continue;
+                }
+                if (reload.pending)
+                {
+                    destroyPendingProgram(*reload.pending);
+                    reload.pending.reset();
+                }
+                try
+                {
+                    reload.pending = submitShaderFile(passes[i].path, parameters, cache);
+                }
+                catch (const std::exception &error)
+                {
+                    std::cerr << "Shader reload failed, keeping the previous program: " << error.what() << "\n";
+                }
+                continue;
+            }
+
+            if (!reload.pending)
+            {
+                continue;
+            }
+            if (parallelCompile)
+            {
+                GLint completed = GL_TRUE;
+                glGetProgramiv(reload.pending->program, GL_COMPLETION_STATUS_KHR, &completed);
+                if (completed != GL_TRUE)
+                {
+                    continue;
+                }
+            }
+
+            try
+            {
+                installReload(pipeline[i], finishShaderProgram(*reload.pending), lookups, passes[i].path);
+            }
+            catch (const std::exception &error)
+            {
+                std::cerr << "Shader reload failed, keeping the previous program: " << error.what() << "\n";
+            }
+            reload.pending.reset();
+        }
     }
 
-    std::vector<ShaderProgram> buildPipeline(const Options &options)
+    // Re-reads the --params file. Live parameters take their new value at once; a pass with a changed constant is
+    // recompiled through the hot reload path and keeps its current program until the new one is ready.
+    void reloadParameterFile(ParameterSettings &settings, std::vector<ShaderProgram> &pipeline,
+                             std::vector<ShaderReload> &reloads)
     {
-        std::vector<ShaderProgram> pipeline;
-        if (options.shaderPaths.empty())
+        try
         {
-            pipeline.emplace_back(buildShaderProgram(std::string(kDefaultShader)));
-            return pipeline;
+            loadParameterFile(settings.file, settings);
+        }
+        catch (const std::exception &error)
+        {
+            std::cerr << "Parameter reload failed, keeping the previous values: " << error.what() << "\n";
+            return;
         }
 
-        pipeline.reserve(options.shaderPaths.size());
-        for (const auto &path : options.shaderPaths)
+        const auto now = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < pipeline.size(); ++i)
         {
-            pipeline.emplace_back(buildShaderFromFile(path));
+            bool recompile = false;
+            for (auto &parameter : pipeline[i].parameters)
+            {
+                const auto value = settings.values.find(parameter.name);
+                if (value == settings.values.end() || value->second == parameter.value)
+                {
+                    continue;
+                }
+                parameter.value = value->second;
+                if (parameter.location >= 0)
+                {
+                    glUseProgram(pipeline[i].program);
+                    glUniform1f(parameter.location, parameter.value);
+                }
+                else
+                {
+                    recompile = true;
+                }
+            }
+            if (recompile)
+            {
+                reloads[i].scheduled = true;
+                reloads[i].due = now;
+            }
         }
-        return pipeline;
+        glUseProgram(0);
     }
 
-    void setCommonUniforms(const ShaderProgram &program, int width, int height, int frameCount, int inputWidth, int inputHeight, float windowOpacity)
+    // Legacy loose uniforms for shaders that do not declare the FrameUniforms block.
+    void setCommonUniforms(const ShaderProgram &program, const FrameUniformBlock &values)
     {
-        glUseProgram(program.program);
-        if (program.textureUniform >= 0)
-        {
-            glUniform1i(program.textureUniform, 0);
-        }
         if (program.inputSizeUniform >= 0)
         {
-            glUniform2f(program.inputSizeUniform, static_cast<float>(inputWidth), static_cast<float>(inputHeight));
+            glUniform2f(program.inputSizeUniform, values.inputSize[0], values.inputSize[1]);
         }
         if (program.textureSizeUniform >= 0)
         {
-            glUniform2f(program.textureSizeUniform, static_cast<float>(inputWidth), static_cast<float>(inputHeight));
+            glUniform2f(program.textureSizeUniform, values.textureSize[0], values.textureSize[1]);
         }
         if (program.outputSizeUniform >= 0)
         {
-            glUniform2f(program.outputSizeUniform, static_cast<float>(width), static_cast<float>(height));
+            glUniform2f(program.outputSizeUniform, values.outputSize[0], values.outputSize[1]);
         }
         if (program.frameCountUniform >= 0)
         {
-            glUniform1i(program.frameCountUniform, frameCount);
-        }
-        if (program.frameDirectionUniform >= 0)
-        {
-            glUniform1i(program.frameDirectionUniform, 1);
-        }
-        if (program.mvpUniform >= 0)
-        {
-            const std::array<float, 16> identity = {1.0f, 0.0f, 0.0f, 0.0f,
-                                                    0.0f, 1.0f, 0.0f, 0.0f,
-                                                    0.0f, 0.0f, 1.0f, 0.0f,
-                                                    0.0f, 0.0f, 0.0f, 1.0f};
-            glUniformMatrix4fv(program.mvpUniform, 1, GL_FALSE, identity.data());
+            glUniform1i(program.frameCountUniform, values.frameCount);
         }
         if (program.opacityUniform >= 0)
         {
-            glUniform1f(program.opacityUniform, windowOpacity);
+            glUniform1f(program.opacityUniform, values.windowOpacity);
         }
     }
 
-    void setExclusionUniforms(const ShaderProgram &program, const ExclusionRect &rect)
+    // One uniform buffer holding a FrameUniformBlock per pass, written with a single upload per frame.
+    struct FrameUniformBuffer
     {
-        glUseProgram(program.program);
-        const GLint currentTexture = glGetUniformLocation(program.program, "CurrentTexture");
-        if (currentTexture >= 0)
-        {
-            glUniform1i(currentTexture, 0);
-        }
-        const GLint backgroundTexture = glGetUniformLocation(program.program, "BackgroundTexture");
-        if (backgroundTexture >= 0)
-        {
-            glUniform1i(backgroundTexture, 1);
-        }
-        const GLint exclusionRect = glGetUniformLocation(program.program, "ExclusionRect");
-        if (exclusionRect >= 0)
-        {
-            glUniform4f(exclusionRect, rect.x, rect.y, rect.width, rect.height);
-        }
-        const GLint hasExclusion = glGetUniformLocation(program.program, "HasExclusion");
-        if (hasExclusion >= 0)
+        GLuint buffer = 0;
+        size_t stride = 0;
+        // Per-pass values and their aligned copy, kept between frames so filling them does not allocate.
+        std::vector<FrameUniformBlock> blocks;
+        std::vector<std::uint8_t> staging;
+    };
+
+    FrameUniformBuffer createFrameUniformBuffer()
+    {
+        FrameUniformBuffer uniforms;
+        GLint alignment = 0;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        const size_t align = static_cast<size_t>(std::max(alignment, 1));
+        uniforms.stride = (sizeof(FrameUniformBlock) + align - 1) / align * align;
+        glGenBuffers(1, &uniforms.buffer);
+        return uniforms;
+    }
+
+    void destroyFrameUniformBuffer(FrameUniformBuffer &uniforms)
+    {
+        if (uniforms.buffer)
         {
-            glUniform1i(hasExclusion, rect.valid ? 1 : 0);
+            glDeleteBuffers(1, &uniforms.buffer);
+            uniforms.buffer = 0;
         }
     }
 
-    void applyExclusionPass(const ShaderProgram &program,
-                            GLuint vao,
-                            GLuint currentTexture,
-                            GLuint backgroundTexture,
-                            const RenderTarget &target,
-                            int width,
-                            int height,
-                            const ExclusionRect &rect)
+    void uploadFrameUniforms(FrameUniformBuffer &uniforms)
     {
-        glBindFramebuffer(GL_FRAMEBUFFER, target.framebuffer);
-        glViewport(0, 0, width, height);
-        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
-        glClear(GL_COLOR_BUFFER_BIT);
-
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, currentTexture);
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, backgroundTexture);
-
-        setExclusionUniforms(program, rect);
-
-        glBindVertexArray(vao);
-        glDrawArrays(GL_TRIANGLES, 0, 6);
+        const std::vector<FrameUniformBlock> &blocks = uniforms.blocks;
+        uniforms.staging.assign(uniforms.stride * blocks.size(), 0);
+        for (size_t i = 0; i < blocks.size(); ++i)
+        {
+            std::memcpy(uniforms.staging.data() + uniforms.stride * i, &blocks[i], sizeof(FrameUniformBlock));
+        }
 
-        glBindVertexArray(0);
-        glBindTexture(GL_TEXTURE_2D, 0);
-        glActiveTexture(GL_TEXTURE0);
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glBindBuffer(GL_UNIFORM_BUFFER, uniforms.buffer);
+        // Orphan first so the driver never waits for last frame's passes to finish reading.
+        glBufferData(GL_UNIFORM_BUFFER, static_cast<GLsizeiptr>(uniforms.staging.size()), nullptr, GL_STREAM_DRAW);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, static_cast<GLsizeiptr>(uniforms.staging.size()), uniforms.staging.data());
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
     }
 
-    void copyTexture(GLuint source, GLuint destination, int width, int height)
+    // Sampler objects carry each pass's filter mode so shared textures keep their own parameters.
+    struct PassSamplers
     {
-        GLuint framebuffer = 0;
-        glGenFramebuffers(1, &framebuffer);
-        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, source, 0);
+        GLuint linear = 0;
+        GLuint nearest = 0;
+    };
 
-        glReadBuffer(GL_COLOR_ATTACHMENT0);
+    PassSamplers createPassSamplers()
+    {
+        PassSamplers samplers;
+        glGenSamplers(1, &samplers.linear);
+        glGenSamplers(1, &samplers.nearest);
+        for (const GLuint sampler : {samplers.linear, samplers.nearest})
+        {
+            const GLint filter = sampler == samplers.linear ? GL_LINEAR : GL_NEAREST;
+            glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, filter);
+            glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, filter);
+            glSamplerParameteri(sampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glSamplerParameteri(sampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        }
+        return samplers;
+    }
 
-        glBindTexture(GL_TEXTURE_2D, destination);
-        glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, static_cast<GLsizei>(width), static_cast<GLsizei>(height));
-        glBindTexture(GL_TEXTURE_2D, 0);
+    void destroyPassSamplers(PassSamplers &samplers)
+    {
+        glDeleteSamplers(1, &samplers.linear);
+        glDeleteSamplers(1, &samplers.nearest);
+        samplers = PassSamplers{};
+    }
 
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        glDeleteFramebuffers(1, &framebuffer);
+    int scaleDimension(ScaleType type, float scale, int source, int viewport)
+    {
+        float size = scale;
+        if (type == ScaleType::Source)
+        {
+            size = static_cast<float>(source) * scale;
+        }
+        else if (type == ScaleType::Viewport)
+        {
+            size = static_cast<float>(viewport) * scale;
+        }
+        return std::max(1, static_cast<int>(std::lround(size)));
     }
 
+    // Intermediate passes render at their preset size; the last pass always fills the window, or
+    // `outputFramebuffer` when one is given. `previousInputs` holds the textures bound as PrevTexture..Prev6Texture.
+    // A pass whose previous output some shader samples as PassFeedbackN keeps it in feedback[N]: its target and
+    // that one trade places after each frame, so last frame's output is kept without a copy.
     void renderPipeline(const std::vector<ShaderProgram> &pipeline,
-                        const std::vector<RenderTarget> &targets,
+                        const std::vector<PassSettings> &passes,
+                        std::vector<PooledTarget> &targets,
+                        std::vector<PooledTarget> &feedback,
+                        RenderTargetPool &targetPool,
+                        FrameUniformBuffer &uniforms,
+                        const PassSamplers &samplers,
+                        const LookupTextureCache &lookups,
+                        PerfTimers *timers,
                         GLuint vao,
                         GLuint baseTexture,
+                        const std::array<GLuint, kHistoryFrames> &previousInputs,
                         int width,
                         int height,
                         int frameCount,
                         float windowOpacity,
                         int inputWidth,
-                        int inputHeight)
+                        int inputHeight,
+                        GLuint outputFramebuffer = 0)
     {
+        const size_t passCount = pipeline.size();
+        const size_t feedbackPasses = std::min(passCount, kMaxFeedbackPasses);
+        // Only the first kMaxFeedbackPasses passes can be read back, so a fixed array covers every pipeline.
+        std::array<bool, kMaxFeedbackPasses> keepsFeedback{};
+        for (const auto &program : pipeline)
+        {
+            for (size_t pass = 0; pass < feedbackPasses; ++pass)
+            {
+                keepsFeedback[pass] = keepsFeedback[pass] || program.feedbackUnits[pass] > 0;
+            }
+        }
+        // The window's back buffer cannot be kept, so a last pass with feedback renders offscreen and is blitted.
+        const bool lastOffscreen = passCount <= kMaxFeedbackPasses && keepsFeedback[passCount - 1];
+        targets.resize(lastOffscreen ? passCount : passCount - 1);
+        feedback.resize(passCount);
+
+        std::vector<FrameUniformBlock> &blocks = uniforms.blocks;
+        blocks.resize(passCount);
+        for (size_t index = 0; index < blocks.size(); ++index)
+        {
+            const bool isLast = index + 1 == blocks.size();
+            const PassSettings &pass = passes[index];
+            const int outputWidth = isLast ? width : scaleDimension(pass.scaleTypeX, pass.scaleX, inputWidth, width);
+            const int outputHeight = isLast ? height : scaleDimension(pass.scaleTypeY, pass.scaleY, inputHeight, height);
+            const GLenum format = pass.floatFramebuffer ? GL_RGBA16F : GL_RGBA8;
+            if (!isLast || lastOffscreen)
+            {
+                targets[index].ensure(targetPool, outputWidth, outputHeight, format);
+            }
+            if (index < feedbackPasses && keepsFeedback[index])
+            {
+                ensureClearedTarget(feedback[index], targetPool, outputWidth, outputHeight, format);
+            }
+            else
+            {
+                feedback[index].reset();
+            }
+
+            FrameUniformBlock &block = blocks[index];
+            block.mvp = kIdentityMatrix;
+            block.outputSize = {static_cast<float>(outputWidth), static_cast<float>(outputHeight)};
+            block.inputSize = {static_cast<float>(inputWidth), static_cast<float>(inputHeight)};
+            block.textureSize = block.inputSize;
+            block.frameCount = frameCount;
+            block.frameDirection = 1;
+            block.windowOpacity = windowOpacity;
+            block.padding = {};
+            inputWidth = outputWidth;
+            inputHeight = outputHeight;
+        }
+        uploadFrameUniforms(uniforms);
+
         GLuint inputTexture = baseTexture;
 
-        for (size_t index = 0; index < pipeline.size(); ++index)
+        for (size_t index = 0; index < passCount; ++index)
         {
-            const bool isLast = index + 1 == pipeline.size();
-            GLuint framebuffer = isLast ? 0 : targets[index % targets.size()].framebuffer;
-            GLuint outputTexture = isLast ? 0 : targets[index % targets.size()].texture;
+            const bool isLast = index + 1 == passCount;
+            const bool onscreen = isLast && !lastOffscreen;
+            GLuint framebuffer = onscreen ? outputFramebuffer : targets[index].get().framebuffer;
+            GLuint outputTexture = onscreen ? 0 : targets[index].get().texture;
 
             glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
-            glViewport(0, 0, width, height);
+            glViewport(0, 0, static_cast<GLsizei>(blocks[index].outputSize[0]),
+                       static_cast<GLsizei>(blocks[index].outputSize[1]));
             glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
             glClear(GL_COLOR_BUFFER_BIT);
 
+            const ShaderProgram &program = pipeline[index];
+            for (size_t age = 0; age < kHistoryFrames; ++age)
+            {
+                if (program.historyUnits[age] > 0)
+                {
+                    glActiveTexture(GL_TEXTURE0 + static_cast<GLenum>(program.historyUnits[age]));
+                    glBindTexture(GL_TEXTURE_2D, previousInputs[age]);
+                    glBindSampler(static_cast<GLuint>(program.historyUnits[age]), 0);
+                }
+            }
+            for (size_t pass = 0; pass < kMaxFeedbackPasses; ++pass)
+            {
+                if (program.feedbackUnits[pass] > 0)
+                {
+                    // A pass past the end of the chain has no output; unbinding keeps the unit from showing
+                    // whatever an earlier pass left there, and an unbound unit samples as opaque black.
+                    glActiveTexture(GL_TEXTURE0 + static_cast<GLenum>(program.feedbackUnits[pass]));
+                    glBindTexture(GL_TEXTURE_2D, pass < feedbackPasses ? feedback[pass].get().texture : 0);
+                    glBindSampler(static_cast<GLuint>(program.feedbackUnits[pass]), 0);
+                }
+            }
+            for (const auto &lookup : program.lookups)
+            {
+                glActiveTexture(GL_TEXTURE0 + static_cast<GLenum>(lookup.unit));
+                glBindTexture(GL_TEXTURE_2D, lookups.texture(lookup.binding));
+                glBindSampler(static_cast<GLuint>(lookup.unit), lookups.sampler(lookup.binding));
+            }
+
             glActiveTexture(GL_TEXTURE0);
             glBindTexture(GL_TEXTURE_2D, inputTexture);
+            glBindSampler(0, passes[index].filterLinear ? samplers.linear : samplers.nearest);
 
-            const ShaderProgram &program = pipeline[index];
-            setCommonUniforms(program, width, height, frameCount, inputWidth, inputHeight, windowOpacity);
+            glUseProgram(program.program);
+            if (program.usesFrameBlock)
+            {
+                glBindBufferRange(GL_UNIFORM_BUFFER, kFrameUniformBinding, uniforms.buffer,
+                                  static_cast<GLintptr>(uniforms.stride * index), sizeof(FrameUniformBlock));
+            }
+            else
+            {
+                setCommonUniforms(program, blocks[index]);
+            }
 
+            beginGpuTiming(timers, kFirstPassGpuStage + index);
             glBindVertexArray(vao);
             glDrawArrays(GL_TRIANGLES, 0, 6);
             glBindVertexArray(0);
+            endGpuTiming(timers);
 
             inputTexture = isLast ? baseTexture : outputTexture;
-            inputWidth = width;
-            inputHeight = height;
         }
 
+        glBindSampler(0, 0);
+        if (lastOffscreen)
+        {
+            upscaleTarget(targets.back().get(), outputFramebuffer, width, height);
+        }
+        for (size_t index = 0; index < feedbackPasses; ++index)
+        {
+            if (keepsFeedback[index])
+            {
+                std::swap(targets[index], feedback[index]);
+            }
+        }
         glBindFramebuffer(GL_FRAMEBUFFER, 0);
     }
 }
@@ -697,6 +6221,11 @@ int main(int argc, char **argv)
     {
         Options options = parseArgs(argc, argv);
 
+#if CRT_HAS_X11
+        // The capture thread talks to the X server on its own connection alongside SDL's.
+        XInitThreads();
+#endif
+
         sdlCheck(SDL_Init(SDL_INIT_VIDEO) == 0, "SDL_Init failed");
 
         SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
@@ -707,8 +6236,13 @@ int main(int argc, char **argv)
 
         SDL_SetHint(SDL_HINT_VIDEO_X11_NET_WM_BYPASS_COMPOSITOR, "0");
 
-        SDL_Window *window = SDL_CreateWindow("Shaderglass CRT", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
-                                              options.width, options.height, SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE);
+        // Benchmarks and filtering render into a hidden, fixed-size window so they also run unattended under Xvfb.
+        const bool benchmark = options.benchmarkFrames > 0;
+        const bool filter = options.source == SourceKind::Filter;
+        const bool headless = benchmark || filter;
+        SDL_Window *window = SDL_CreateWindow(
+            "Shaderglass CRT", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, options.width, options.height,
+            SDL_WINDOW_OPENGL | (headless ? SDL_WINDOW_HIDDEN : SDL_WINDOW_RESIZABLE));
         sdlCheck(window != nullptr, "SDL_CreateWindow failed");
 
         sdlCheck(SDL_SetWindowOpacity(window, options.opacity) == 0, "SDL_SetWindowOpacity failed");
@@ -716,37 +6250,233 @@ int main(int argc, char **argv)
         SDL_GLContext context = SDL_GL_CreateContext(window);
         sdlCheck(context != nullptr, "SDL_GL_CreateContext failed");
 
-        SDL_GL_SetSwapInterval(1);
+        // Adaptive vsync (late swaps tear instead of waiting a whole refresh) falls back to regular vsync.
+        const int swapInterval = headless ? 0 : options.swapInterval;
+        if (SDL_GL_SetSwapInterval(swapInterval) != 0 && swapInterval < 0)
+        {
+            std::cerr << "Adaptive vsync unsupported; using vsync\n";
+            SDL_GL_SetSwapInterval(1);
+        }
+        reduceTimerSlack();
 
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        // Blending only serves window translucency. Filtered frames are written out as the shaders produce them;
+        // blended over the cleared target, their colour would be scaled by the shader's alpha.
+        if (!filter)
+        {
+            glEnable(GL_BLEND);
+            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        }
 
-        std::vector<ShaderProgram> pipeline = buildPipeline(options);
-        ShaderProgram exclusionProgram = buildShaderProgram(std::string(kExclusionShader));
+        const bool parallelCompile = enableParallelShaderCompile();
+        const auto programsStart = std::chrono::steady_clock::now();
+        ProgramCache programCache = openProgramCache(options.shaderCache);
+        std::vector<ShaderProgram> pipeline = buildPipeline(options, programCache);
+        std::optional<LookupTextureCache> lookupTextures;
+        lookupTextures.emplace(options.lookupTextures);
+        for (auto &program : pipeline)
+        {
+            attachLookupTextures(program, *lookupTextures);
+        }
+        CaptureUnpacker unpacker = createCaptureUnpacker(static_cast<size_t>(options.uploadBuffers), programCache);
+        PerfHud hud = options.hud ? createPerfHud(programCache) : PerfHud{};
+        const double programsMilliseconds =
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - programsStart).count();
+        if (programCache.directory.empty())
+        {
+            std::cerr << "Shader programs built in " << programsMilliseconds << " ms (binary cache off, "
+                      << (parallelCompile ? "parallel" : "serial") << " compile)\n";
+        }
+        else
+        {
+            std::cerr << "Shader programs built in " << programsMilliseconds << " ms (binary cache: "
+                      << programCache.hits << " hits, " << programCache.misses << " misses, "
+                      << (parallelCompile ? "parallel" : "serial") << " compile)\n";
+        }
         GLuint vao = buildFullscreenVAO();
+        FrameUniformBuffer frameUniforms = createFrameUniformBuffer();
+
+        const int patternWidth = options.sourceWidth > 0 ? options.sourceWidth : options.width;
+        const int patternHeight = options.sourceHeight > 0 ? options.sourceHeight : options.height;
+        checkTextureSize(patternWidth, patternHeight, "Source size");
+        // The pattern is the pattern source itself, and for the desktop the placeholder until the first capture
+        // arrives or the benchmark's synthetic capture; other sources never show it.
+        const bool usesPattern = options.source == SourceKind::Desktop || options.source == SourceKind::Pattern;
+        const std::vector<std::uint8_t> pattern =
+            usesPattern ? buildTestPattern(patternWidth, patternHeight) : std::vector<std::uint8_t>{};
+        GLuint patternTexture = usesPattern ? createTexture(patternWidth, patternHeight, pattern) : 0;
+
+        std::string captureBackend;
+        std::optional<CaptureThread> captureThread;
+        CaptureSlot syntheticSlot;
+        std::optional<ProceduralSource> procedural;
+        std::optional<TraceReplay> replay;
+        std::optional<RawFrameReader> filterInput;
+#if CRT_HAS_COMPOSITE
+        std::optional<CompositeCapture> composite;
+#endif
+        if (options.source == SourceKind::Replay)
+        {
+            replay.emplace(options.replayPath);
+        }
+        else if (filter)
+        {
+            filterInput.emplace(options.filterInput, patternWidth, patternHeight);
+        }
+        else if (options.source != SourceKind::Desktop && options.source != SourceKind::Pattern)
+        {
+            procedural = createProceduralSource(options.source, patternWidth, patternHeight, programCache);
+        }
+        else if (options.source == SourceKind::Pattern)
+        {
+            // The static pattern below is the whole source.
+        }
+        else if (benchmark)
+        {
+            syntheticSlot = buildSyntheticSlot(pattern, patternWidth, patternHeight);
+        }
+        else
+        {
+            if (options.compositeCapture)
+            {
+#if CRT_HAS_COMPOSITE
+                try
+                {
+                    composite.emplace(window, options.compositeWindow, programCache);
+                    captureBackend = "XComposite + GLX_EXT_texture_from_pixmap";
+                    std::cerr << "Desktop capture: " << captureBackend << "\n";
+                }
+                catch (const std::exception &ex)
+                {
+                    std::cerr << "Composite capture unavailable (" << ex.what() << "); using CPU capture\n";
+                }
+#else
+                std::cerr << "Composite capture not built in; using CPU capture\n";
+#endif
+            }
+#if CRT_HAS_COMPOSITE
+            if (!composite)
+#endif
+            {
+                const auto captureInterval =
+                    options.captureFps > 0.0f
+                        ? std::chrono::nanoseconds(static_cast<std::int64_t>(1.0e9 / options.captureFps))
+                        : std::chrono::nanoseconds(0);
+                CaptureSettings settings;
+                settings.trackDamage = options.damage;
+                settings.monitor = options.monitor;
+                settings.monitorIndex = options.monitorIndex;
+                settings.windowRegion = options.captureWindowRegion;
+                captureThread.emplace(settings, captureInterval);
+            }
+        }
+        std::optional<TraceRecorder> recorder;
+        if (!options.recordPath.empty())
+        {
+            recorder.emplace(options.recordPath);
+        }
+        CaptureRegion excluded;
+
+        // Filtered frames render offscreen and come back through a ring of pack buffers to the writer thread.
+        // Every render target the pipeline draws into comes from one pool and goes back to it when released.
+        RenderTargetPool targetPool;
+        PooledTarget filterTarget;
+        ReadbackRing readback;
+        std::optional<RawFrameWriter> filterOutput;
+        if (filter)
+        {
+            filterTarget.ensure(targetPool, options.width, options.height);
+            readback = createReadbackRing(3, options.width, options.height);
+            filterOutput.emplace(static_cast<size_t>(options.width) * static_cast<size_t>(options.height) * 4);
+        }
 
-        const int patternWidth = options.width;
-        const int patternHeight = options.height;
-        const auto pattern = buildTestPattern(patternWidth, patternHeight);
+        const std::vector<PassSettings> passes = options.passes.empty() ? std::vector<PassSettings>(1) : options.passes;
+        PassSamplers samplers = createPassSamplers();
+        std::vector<PooledTarget> targets;
+        std::vector<PooledTarget> feedbackTargets;
+        InputHistory inputHistory;
+
+        // Timers only exist when something shows their numbers, so the default loop issues no queries.
+        std::optional<PerfTimers> perfTimers;
+        if (options.stats || options.hud || benchmark || options.frameBudget > 0.0f)
+        {
+            std::vector<std::string> passNames;
+            for (const auto &pass : passes)
+            {
+                passNames.push_back(pass.path.empty() ? "built-in" : std::filesystem::path(pass.path).filename().string());
+            }
+            perfTimers = createPerfTimers(passNames, benchmark ? static_cast<size_t>(options.benchmarkFrames)
+                                                               : kTimingSamples);
+        }
+        PerfTimers *timers = perfTimers ? &*perfTimers : nullptr;
 
-        ScreenCapture capture;
-        std::vector<std::uint8_t> captureBuffer;
-        int sourceWidth = patternWidth;
-        int sourceHeight = patternHeight;
-        GLuint baseTexture = createTexture(patternWidth, patternHeight, pattern);
-        GLuint backgroundTexture = createTexture(patternWidth, patternHeight, pattern);
-        RenderTarget exclusionTarget = createRenderTarget(patternWidth, patternHeight);
+        // Below full scale, or while a resize settles, the pipeline renders into scaledTarget, which is then blitted
+        // up to the window size.
+        RenderGovernor governor;
+        governor.budget = options.frameBudget;
+        governor.minScale = options.minRenderScale;
+        governor.maxScale = options.maxRenderScale;
+        governor.scale = options.frameBudget > 0.0f ? options.maxRenderScale : 1.0f;
+        PooledTarget scaledTarget;
+        // The size the pipeline is laid out for. It follows the window only once a drag-resize has paused, so a
+        // resize storm costs one rebuild of the intermediate targets instead of one per event.
+        int layoutWidth = options.width;
+        int layoutHeight = options.height;
+        std::optional<std::chrono::steady_clock::time_point> layoutDue;
 
-        std::vector<RenderTarget> targets;
-        for (size_t i = 0; i + 1 < pipeline.size(); ++i)
+        ShaderWatcher watcher = headless ? ShaderWatcher{} : createShaderWatcher(passes, options.parameters.file);
+        std::optional<std::chrono::steady_clock::time_point> parametersDue;
+        std::vector<ShaderReload> reloads(pipeline.size());
+        std::optional<ShaderCompileThread> compiler;
+        if (watcher.fd >= 0 && !parallelCompile)
         {
-            targets.emplace_back(createRenderTarget(options.width, options.height));
+            try
+            {
+                compiler.emplace(window, context, programCache);
+            }
+            catch (const std::exception &error)
+            {
+                std::cerr << error.what() << "; shader reloads will stall a frame\n";
+            }
         }
+        auto lastHudUpdate = std::chrono::steady_clock::now();
 
+        FrameStats stats;
+        // The upload ring and the capture thread count since startup; the stats line reports them per window.
+        std::uint64_t reportedUploadWaits = 0;
+        std::uint64_t reportedDropped = 0;
+        std::uint64_t reportedReused = 0;
+        std::uint64_t reportedLate = 0;
+        bool captureActive = false;
+        auto lastSwap = std::chrono::steady_clock::now();
+        const auto frameLimit = options.maxFps > 0.0f
+                                    ? std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                          std::chrono::duration<double>(1.0 / options.maxFps))
+                                    : std::chrono::steady_clock::duration::zero();
+        auto nextFrame = lastSwap;
+        std::chrono::steady_clock::duration frameInterval = std::chrono::microseconds(16667);
         bool running = true;
         int frameCount = 0;
+        // Benchmark timings start after a short warm-up so first-use driver work does not skew them.
+        constexpr int kBenchmarkWarmupFrames = 10;
+        auto benchmarkStart = std::chrono::steady_clock::now();
+        const auto filterStart = benchmarkStart;
         while (running)
         {
+            if (benchmark && frameCount == kBenchmarkWarmupFrames)
+            {
+                glFinish();
+                for (auto &stage : timers->stages)
+                {
+                    stage.samples.clear();
+                    stage.next = 0;
+                }
+                for (auto &issued : timers->issued)
+                {
+                    std::fill(issued.begin(), issued.end(), false);
+                }
+                benchmarkStart = std::chrono::steady_clock::now();
+            }
+
             SDL_Event event;
             while (SDL_PollEvent(&event))
             {
@@ -758,85 +6488,336 @@ int main(int argc, char **argv)
                 {
                     options.width = event.window.data1;
                     options.height = event.window.data2;
-                    targets.clear();
-                    for (size_t i = 0; i + 1 < pipeline.size(); ++i)
+                    layoutDue = std::chrono::steady_clock::now() + std::chrono::milliseconds(150);
+                }
+            }
+
+            // Editors write a file in several steps; reload once it has been quiet for a moment.
+            for (const size_t index : pollShaderWatcher(watcher))
+            {
+                reloads[index].scheduled = true;
+                reloads[index].due = std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+            }
+            if (watcher.parametersChanged)
+            {
+                watcher.parametersChanged = false;
+                parametersDue = std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+            }
+            if (parametersDue && std::chrono::steady_clock::now() >= *parametersDue)
+            {
+                parametersDue.reset();
+                reloadParameterFile(options.parameters, pipeline, reloads);
+            }
+            updateShaderReloads(pipeline, passes, reloads, options.parameters, programCache, *lookupTextures,
+                                parallelCompile, compiler ? &*compiler : nullptr);
+
+            // With --monitor=auto the window's area also tells the capture thread which monitor to grab.
+            if ((options.captureWindowRegion || options.monitor == "auto") && captureThread)
+            {
+                int windowX = 0;
+                int windowY = 0;
+                int windowWidth = 0;
+                int windowHeight = 0;
+                SDL_GetWindowPosition(window, &windowX, &windowY);
+                SDL_GetWindowSize(window, &windowWidth, &windowHeight);
+                captureThread->setRegion(CaptureRegion{windowX - options.captureMargin, windowY - options.captureMargin,
+                                                      windowWidth + 2 * options.captureMargin,
+                                                      windowHeight + 2 * options.captureMargin});
+            }
+
+            const CaptureSlot *slot = captureThread          ? captureThread->acquire(frameInterval)
+                                      : replay                 ? replay->next(options.replayRealtime && !benchmark)
+                                      : filterInput            ? filterInput->next()
+                                      : syntheticSlot.captured ? &syntheticSlot
+                                                               : nullptr;
+            if (filterInput && !slot)
+            {
+                break;
+            }
+            // Only pipelines that sample PrevTexture..Prev6Texture keep input history.
+            const size_t historyDepth = inputHistoryDepth(pipeline);
+            std::uint64_t damagedPixels = 0;
+            unpacker.uploadedBytes = 0;
+            if (slot)
+            {
+                if (captureBackend != slot->frame.backend)
+                {
+                    captureBackend = slot->frame.backend;
+                    std::cerr << "Desktop capture: " << captureBackend << "\n";
+                }
+                captureActive = slot->captured;
+                if (slot->captured)
+                {
+                    recordCpuTiming(timers, kCaptureStage, slot->grabTime);
+                    const CaptureFrame &frame = slot->frame;
+                    if (recorder && !frame.rects.empty())
+                    {
+                        recorder->write(*slot);
+                    }
+                    const CaptureRegion exclusion =
+                        captureThread ? windowExclusion(window, frame.originX, frame.originY, frame.width, frame.height)
+                                      : CaptureRegion{};
+                    if (exclusion.x != excluded.x || exclusion.y != excluded.y || exclusion.width != excluded.width ||
+                        exclusion.height != excluded.height)
                     {
-                        targets.emplace_back(createRenderTarget(options.width, options.height));
+                        // Whatever the window uncovered was skipped while excluded; have it fetched again.
+                        captureThread->refresh(excluded);
+                        excluded = exclusion;
                     }
+                    const auto convertStart = std::chrono::steady_clock::now();
+                    beginGpuTiming(timers, kUploadGpuStage);
+                    // With history in use each new capture is converted into the next slot of the ring.
+                    const RenderTarget *historySlot =
+                        historyDepth > 0 ? &advanceInputHistory(inputHistory, targetPool, historyDepth, frame.width,
+                                                                frame.height, captureOutputFormat(frame))
+                                         : nullptr;
+                    unpackCapture(unpacker, frame, vao, excluded, historySlot);
+                    endGpuTiming(timers);
+                    recordCpuTiming(timers, kConvertStage, std::chrono::steady_clock::now() - convertStart);
+                    damagedPixels = frame.damagedPixels;
                 }
             }
 
-            int captureWidth = 0;
-            int captureHeight = 0;
-            bool captured = capture.grab(captureBuffer, captureWidth, captureHeight);
+            GLuint baseTexture = patternTexture;
+            int sourceWidth = patternWidth;
+            int sourceHeight = patternHeight;
+            if (procedural)
+            {
+                const RenderTarget *historySlot =
+                    historyDepth > 0 ? &advanceInputHistory(inputHistory, targetPool, historyDepth,
+                                                            procedural->target.width, procedural->target.height,
+                                                            GL_RGBA8)
+                                     : nullptr;
+                beginGpuTiming(timers, kUploadGpuStage);
+                renderProceduralSource(*procedural, vao, frameCount, historySlot);
+                endGpuTiming(timers);
+                baseTexture = historySlot ? historySlot->texture : procedural->target.texture;
+                sourceWidth = procedural->target.width;
+                sourceHeight = procedural->target.height;
+            }
+#if CRT_HAS_COMPOSITE
+            else if (composite)
+            {
+                composite->poll();
+                const RenderTarget *historySlot =
+                    historyDepth > 0 ? &advanceInputHistory(inputHistory, targetPool, historyDepth, composite->width(),
+                                                            composite->height(), GL_RGBA8)
+                                     : nullptr;
+                beginGpuTiming(timers, kUploadGpuStage);
+                composite->capture(vao, historySlot);
+                endGpuTiming(timers);
+                baseTexture = historySlot ? historySlot->texture : composite->output().texture;
+                sourceWidth = composite->width();
+                sourceHeight = composite->height();
+            }
+#endif
+            else if (captureActive && unpacker.output.texture)
+            {
+                baseTexture = unpacker.output.texture;
+                sourceWidth = unpacker.width;
+                sourceHeight = unpacker.height;
+            }
+            else if (captureActive && !inputHistory.frames.empty())
+            {
+                // Also covers history just switched off: the ring stands in until the next capture rebuilds
+                // unpacker.output.
+                baseTexture = inputHistoryTexture(inputHistory, 0);
+                sourceWidth = unpacker.width;
+                sourceHeight = unpacker.height;
+            }
+            if (historyDepth == 0 && (!captureActive || unpacker.output.texture))
+            {
+                inputHistory.frames.clear();
+            }
+
+            // A static source (the test pattern) is its own history.
+            std::array<GLuint, kHistoryFrames> previousInputs;
+            for (size_t age = 0; age < kHistoryFrames; ++age)
+            {
+                previousInputs[age] =
+                    inputHistory.frames.empty() ? baseTexture : inputHistoryTexture(inputHistory, age + 1);
+            }
+
+            int renderWidth = options.width;
+            int renderHeight = options.height;
+            GLuint pipelineOutput = filterTarget.get().framebuffer;
+            if (layoutDue && std::chrono::steady_clock::now() >= *layoutDue)
+            {
+                layoutWidth = options.width;
+                layoutHeight = options.height;
+                layoutDue.reset();
+            }
+            if (governor.scale < 1.0f || layoutWidth != options.width || layoutHeight != options.height)
+            {
+                renderWidth = std::max(1, static_cast<int>(std::lround(layoutWidth * governor.scale)));
+                renderHeight = std::max(1, static_cast<int>(std::lround(layoutHeight * governor.scale)));
+                scaledTarget.ensure(targetPool, renderWidth, renderHeight);
+                pipelineOutput = scaledTarget.get().framebuffer;
+            }
+            else
+            {
+                scaledTarget.reset();
+            }
 
-            if (captured)
+            lookupTextures->update();
+            // Filtered frames are written out as the shaders produce them, without window translucency.
+            renderPipeline(pipeline, passes, targets, feedbackTargets, targetPool, frameUniforms, samplers,
+                           *lookupTextures, timers, vao, baseTexture, previousInputs, renderWidth, renderHeight,
+                           frameCount, filter ? 1.0f : options.opacity, sourceWidth, sourceHeight, pipelineOutput);
+            if (pipelineOutput != filterTarget.get().framebuffer)
+            {
+                upscaleTarget(scaledTarget.get(), filterTarget.get().framebuffer, options.width, options.height);
+            }
+            targetPool.endFrame();
+            if (options.hud)
+            {
+                drawPerfHud(hud, vao, options.width, options.height);
+            }
+            if (frameLimit.count() > 0)
             {
-                const bool sizeChanged = captureWidth != sourceWidth || captureHeight != sourceHeight;
-                if (sizeChanged)
+                // Deadlines advance by whole intervals so the average rate holds when single frames run late.
+                nextFrame += frameLimit;
+                const auto now = std::chrono::steady_clock::now();
+                if (nextFrame < now)
                 {
-                    glDeleteTextures(1, &baseTexture);
-                    baseTexture = createTexture(captureWidth, captureHeight, captureBuffer);
-                    glDeleteTextures(1, &backgroundTexture);
-                    backgroundTexture = createTexture(captureWidth, captureHeight, captureBuffer);
-                    destroyRenderTarget(exclusionTarget);
-                    exclusionTarget = createRenderTarget(captureWidth, captureHeight);
-                    sourceWidth = captureWidth;
-                    sourceHeight = captureHeight;
+                    nextFrame = now;
                 }
                 else
                 {
-                    glBindTexture(GL_TEXTURE_2D, baseTexture);
-                    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, captureWidth, captureHeight, GL_RGBA, GL_UNSIGNED_BYTE,
-                                    captureBuffer.data());
-                    glBindTexture(GL_TEXTURE_2D, 0);
+                    preciseSleepUntil(nextFrame);
+                }
+            }
+            const auto swapStart = std::chrono::steady_clock::now();
+            if (filter)
+            {
+                // Frames are collected only once every pack buffer is in flight, so each copy has had a few frames
+                // of GPU time to finish and mapping it rarely waits.
+                if (readback.pending == readback.buffers.size() && !writeFilteredFrame(readback, *filterOutput))
+                {
+                    running = false;
                 }
-                sourceWidth = captureWidth;
-                sourceHeight = captureHeight;
+                queueReadback(readback, filterTarget.get().framebuffer);
+            }
+            else
+            {
+                SDL_GL_SwapWindow(window);
+            }
+            frameCount++;
+
+            const auto swapTime = std::chrono::steady_clock::now();
+            if (timers)
+            {
+                recordCpuTiming(timers, kSwapStage, swapTime - swapStart);
+                updateRenderGovernor(governor, advancePerfTimers(*timers));
             }
-            else if (sourceWidth != patternWidth || sourceHeight != patternHeight)
+            if (options.hud && swapTime - lastHudUpdate >= std::chrono::milliseconds(500))
             {
-                glDeleteTextures(1, &baseTexture);
-                baseTexture = createTexture(patternWidth, patternHeight, pattern);
-                glDeleteTextures(1, &backgroundTexture);
-                backgroundTexture = createTexture(patternWidth, patternHeight, pattern);
-                destroyRenderTarget(exclusionTarget);
-                exclusionTarget = createRenderTarget(patternWidth, patternHeight);
-                sourceWidth = patternWidth;
-                sourceHeight = patternHeight;
+                updatePerfHud(hud, *timers);
+                lastHudUpdate = swapTime;
             }
+            frameInterval = swapTime - lastSwap;
+            lastSwap = swapTime;
 
-            ExclusionRect exclusion = buildExclusionRect(window, sourceWidth, sourceHeight);
-            GLuint processedTexture = baseTexture;
+            if (options.stats)
+            {
+                stats.frames++;
+                stats.damagedPixels += damagedPixels;
+                stats.uploadedBytes += unpacker.uploadedBytes;
+                stats.uploadWaits += unpacker.uploads.fenceWaits - reportedUploadWaits;
+                reportedUploadWaits = unpacker.uploads.fenceWaits;
+                stats.renderScale = governor.scale;
+                stats.renderTargets = targetPool.targetCount();
+                stats.renderTargetBytes = targetPool.allocatedBytes();
+                if (captureThread)
+                {
+                    const std::uint64_t dropped = captureThread->droppedFrames();
+                    stats.droppedCaptures += dropped - reportedDropped;
+                    reportedDropped = dropped;
+                    stats.reusedCaptures += captureThread->reusedFrames - reportedReused;
+                    reportedReused = captureThread->reusedFrames;
+                    stats.lateCaptures += captureThread->lateFrames - reportedLate;
+                    reportedLate = captureThread->lateFrames;
+                }
+                if (reportStats(stats, captureBackend))
+                {
+                    reportTimings(*timers);
+                }
+            }
 
-            if (exclusion.valid)
+            if (benchmark && frameCount >= kBenchmarkWarmupFrames + options.benchmarkFrames)
             {
-                applyExclusionPass(exclusionProgram, vao, baseTexture, backgroundTexture, exclusionTarget, sourceWidth,
-                                   sourceHeight, exclusion);
-                processedTexture = exclusionTarget.texture;
+                running = false;
             }
+        }
 
-            copyTexture(processedTexture, backgroundTexture, sourceWidth, sourceHeight);
+        if (benchmark)
+        {
+            glFinish();
+            const double seconds =
+                std::chrono::duration<double>(std::chrono::steady_clock::now() - benchmarkStart).count();
+            // Every query has completed after glFinish; one trip around the ring collects the last few frames.
+            for (size_t i = 0; i < kTimerFrames; ++i)
+            {
+                advancePerfTimers(*timers);
+            }
+            printBenchmarkReport(std::cout, options, passes, options.benchmarkFrames, seconds, *timers);
+        }
 
-            renderPipeline(pipeline, targets, vao, processedTexture, options.width, options.height, frameCount,
-                           options.opacity, sourceWidth, sourceHeight);
-            SDL_GL_SwapWindow(window);
-            frameCount++;
+        if (filter)
+        {
+            while (readback.pending > 0 && writeFilteredFrame(readback, *filterOutput))
+            {
+            }
+            const bool written = filterOutput->finish();
+            const double seconds =
+                std::chrono::duration<double>(std::chrono::steady_clock::now() - filterStart).count();
+            std::cerr << "Filtered " << frameCount << " frames (" << patternWidth << "x" << patternHeight << " to "
+                      << options.width << "x" << options.height << ") in " << std::fixed << std::setprecision(2)
+                      << seconds << " s: " << (seconds > 0.0 ? frameCount / seconds : 0.0) << " fps, "
+                      << readback.fenceWaits << " readback waits\n";
+            if (!written)
+            {
+                throw std::runtime_error("Writing filtered frames failed");
+            }
         }
 
-        for (const auto &target : targets)
+        targets.clear();
+        feedbackTargets.clear();
+        inputHistory.frames.clear();
+        filterTarget.reset();
+        scaledTarget.reset();
+        targetPool.clear();
+        destroyReadbackRing(readback);
+        destroyPassSamplers(samplers);
+        for (auto &reload : reloads)
         {
-            glDeleteFramebuffers(1, &target.framebuffer);
-            glDeleteTextures(1, &target.texture);
+            if (reload.pending)
+            {
+                destroyPendingProgram(*reload.pending);
+            }
+        }
+        compiler.reset();
+        destroyShaderWatcher(watcher);
+        if (perfTimers)
+        {
+            destroyPerfTimers(*perfTimers);
+        }
+        destroyPerfHud(hud);
+        destroyCaptureUnpacker(unpacker);
+        glDeleteTextures(1, &patternTexture);
+        if (procedural)
+        {
+            destroyProceduralSource(*procedural);
         }
-        destroyRenderTarget(exclusionTarget);
-        glDeleteTextures(1, &backgroundTexture);
-        glDeleteTextures(1, &baseTexture);
+        lookupTextures.reset();
+#if CRT_HAS_COMPOSITE
+        composite.reset();
+#endif
         for (const auto &program : pipeline)
         {
             glDeleteProgram(program.program);
         }
-        glDeleteProgram(exclusionProgram.program);
+        destroyFrameUniformBuffer(frameUniforms);
         glDeleteVertexArrays(1, &vao);
 
         SDL_GL_DeleteContext(context);
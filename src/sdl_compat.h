@@ -19,6 +19,11 @@ using GLboolean = unsigned char;
 using GLfloat = float;
 using GLchar = char;
 using GLsizeiptr = std::ptrdiff_t;
+using GLintptr = std::ptrdiff_t;
+using GLbitfield = unsigned int;
+using GLubyte = unsigned char;
+using GLuint64 = std::uint64_t;
+using GLsync = struct __GLsync *;
 
 struct SDL_Window
 {
@@ -28,6 +33,7 @@ constexpr std::uint32_t SDL_INIT_VIDEO = 0x00000020u;
 constexpr int SDL_WINDOWPOS_CENTERED = 0;
 constexpr std::uint32_t SDL_WINDOW_OPENGL = 0x00000002u;
 constexpr std::uint32_t SDL_WINDOW_RESIZABLE = 0x00000020u;
+constexpr std::uint32_t SDL_WINDOW_HIDDEN = 0x00000008u;
 
 enum SDL_GLattr
 {
@@ -35,7 +41,8 @@ enum SDL_GLattr
     SDL_GL_CONTEXT_MINOR_VERSION,
     SDL_GL_CONTEXT_PROFILE_MASK,
     SDL_GL_DOUBLEBUFFER,
-    SDL_GL_ALPHA_SIZE
+    SDL_GL_ALPHA_SIZE,
+    SDL_GL_SHARE_WITH_CURRENT_CONTEXT
 };
 
 constexpr int SDL_GL_CONTEXT_PROFILE_CORE = 1;
@@ -105,6 +112,11 @@ inline void SDL_GL_DeleteContext(SDL_GLContext context)
     delete reinterpret_cast<int *>(context);
 }
 
+inline int SDL_GL_MakeCurrent(SDL_Window *, SDL_GLContext)
+{
+    return 0;
+}
+
 inline int SDL_GL_SetSwapInterval(int)
 {
     return 0;
@@ -112,6 +124,11 @@ inline int SDL_GL_SetSwapInterval(int)
 
 inline void SDL_GL_SwapWindow(SDL_Window *) {}
 
+inline void *SDL_GL_GetProcAddress(const char *)
+{
+    return nullptr;
+}
+
 inline void SDL_GetWindowPosition(SDL_Window *, int *x, int *y)
 {
     if (x)
@@ -163,14 +180,64 @@ constexpr GLenum GL_LINEAR = 0x2601;
 constexpr GLenum GL_TEXTURE_WRAP_S = 0x2802;
 constexpr GLenum GL_TEXTURE_WRAP_T = 0x2803;
 constexpr GLenum GL_CLAMP_TO_EDGE = 0x812F;
+constexpr GLenum GL_CLAMP_TO_BORDER = 0x812D;
+constexpr GLenum GL_REPEAT = 0x2901;
+constexpr GLenum GL_MIRRORED_REPEAT = 0x8370;
+constexpr GLenum GL_NEAREST_MIPMAP_NEAREST = 0x2700;
+constexpr GLenum GL_LINEAR_MIPMAP_LINEAR = 0x2703;
+constexpr GLenum GL_ACTIVE_UNIFORMS = 0x8B86;
+constexpr GLenum GL_SAMPLER_2D = 0x8B5E;
 constexpr GLenum GL_COLOR_ATTACHMENT0 = 0x8CE0;
 constexpr GLenum GL_FRAMEBUFFER = 0x8D40;
+constexpr GLenum GL_READ_FRAMEBUFFER = 0x8CA8;
+constexpr GLenum GL_DRAW_FRAMEBUFFER = 0x8CA9;
 constexpr GLenum GL_FRAMEBUFFER_COMPLETE = 0x8CD5;
 constexpr GLenum GL_COLOR_BUFFER_BIT = 0x00004000;
 constexpr GLenum GL_BLEND = 0x0BE2;
 constexpr GLenum GL_SRC_ALPHA = 0x0302;
 constexpr GLenum GL_ONE_MINUS_SRC_ALPHA = 0x0303;
 constexpr GLboolean GL_TRUE = 1;
+constexpr GLenum GL_NEAREST = 0x2600;
+constexpr GLenum GL_RGB10_A2 = 0x8059;
+constexpr GLenum GL_RGBA8UI = 0x8D7C;
+constexpr GLenum GL_RGB8UI = 0x8D7D;
+constexpr GLenum GL_RGB_INTEGER = 0x8D98;
+constexpr GLenum GL_RGBA_INTEGER = 0x8D99;
+constexpr GLenum GL_UNPACK_ALIGNMENT = 0x0CF5;
+constexpr GLenum GL_UNPACK_ROW_LENGTH = 0x0CF2;
+constexpr GLenum GL_SCISSOR_TEST = 0x0C11;
+constexpr GLenum GL_EXTENSIONS = 0x1F03;
+constexpr GLenum GL_NUM_EXTENSIONS = 0x821D;
+constexpr GLenum GL_PIXEL_UNPACK_BUFFER = 0x88EC;
+constexpr GLenum GL_STREAM_DRAW = 0x88E0;
+constexpr GLenum GL_PIXEL_PACK_BUFFER = 0x88EB;
+constexpr GLenum GL_STREAM_READ = 0x88E1;
+constexpr GLenum GL_PACK_ALIGNMENT = 0x0D05;
+constexpr GLbitfield GL_MAP_READ_BIT = 0x0001;
+constexpr GLbitfield GL_MAP_WRITE_BIT = 0x0002;
+constexpr GLbitfield GL_MAP_INVALIDATE_BUFFER_BIT = 0x0008;
+constexpr GLbitfield GL_MAP_PERSISTENT_BIT = 0x0040;
+constexpr GLbitfield GL_MAP_COHERENT_BIT = 0x0080;
+constexpr GLenum GL_SYNC_GPU_COMMANDS_COMPLETE = 0x9117;
+constexpr GLbitfield GL_SYNC_FLUSH_COMMANDS_BIT = 0x00000001;
+constexpr GLenum GL_ALREADY_SIGNALED = 0x911A;
+constexpr GLenum GL_TIMEOUT_EXPIRED = 0x911B;
+constexpr GLenum GL_CONDITION_SATISFIED = 0x911C;
+constexpr GLenum GL_WAIT_FAILED = 0x911D;
+constexpr GLenum GL_UNIFORM_BUFFER = 0x8A11;
+constexpr GLenum GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT = 0x8A34;
+constexpr GLuint GL_INVALID_INDEX = 0xFFFFFFFFu;
+constexpr GLenum GL_RGBA16F = 0x881A;
+constexpr GLenum GL_MAX_TEXTURE_SIZE = 0x0D33;
+constexpr GLenum GL_TIME_ELAPSED = 0x88BF;
+constexpr GLenum GL_QUERY_RESULT = 0x8866;
+constexpr GLenum GL_QUERY_RESULT_AVAILABLE = 0x8867;
+constexpr GLenum GL_VENDOR = 0x1F00;
+constexpr GLenum GL_RENDERER = 0x1F01;
+constexpr GLenum GL_VERSION = 0x1F02;
+constexpr GLenum GL_PROGRAM_BINARY_RETRIEVABLE_HINT = 0x8257;
+constexpr GLenum GL_PROGRAM_BINARY_LENGTH = 0x8741;
+constexpr GLenum GL_NUM_PROGRAM_BINARY_FORMATS = 0x87FE;
 
 inline GLuint glCreateShader(GLenum)
 {
@@ -216,8 +283,99 @@ inline void glGetProgramiv(GLuint, GLenum, GLint *params)
 
 inline void glGetProgramInfoLog(GLuint, GLsizei, GLsizei *, GLchar *) {}
 
+inline void glGetActiveUniform(GLuint, GLuint, GLsizei, GLsizei *length, GLint *size, GLenum *type, GLchar *name)
+{
+    if (length)
+    {
+        *length = 0;
+    }
+    if (size)
+    {
+        *size = 0;
+    }
+    if (type)
+    {
+        *type = 0;
+    }
+    if (name)
+    {
+        *name = '\0';
+    }
+}
+
 inline void glDeleteProgram(GLuint) {}
 
+inline void glProgramParameteri(GLuint, GLenum, GLint) {}
+
+inline void glGenSamplers(GLsizei n, GLuint *samplers)
+{
+    static GLuint counter = 400;
+    for (GLsizei i = 0; i < n; ++i)
+    {
+        samplers[i] = counter++;
+    }
+}
+
+inline void glDeleteSamplers(GLsizei, const GLuint *) {}
+
+inline void glGenQueries(GLsizei n, GLuint *queries)
+{
+    static GLuint counter = 500;
+    for (GLsizei i = 0; i < n; ++i)
+    {
+        queries[i] = counter++;
+    }
+}
+
+inline void glDeleteQueries(GLsizei, const GLuint *) {}
+
+inline void glBeginQuery(GLenum, GLuint) {}
+
+inline void glEndQuery(GLenum) {}
+
+inline void glFinish() {}
+
+inline void glFlush() {}
+
+inline void glGetQueryObjectiv(GLuint, GLenum, GLint *params)
+{
+    if (params)
+    {
+        *params = 1;
+    }
+}
+
+inline void glGetQueryObjectui64v(GLuint, GLenum, GLuint64 *params)
+{
+    if (params)
+    {
+        *params = 0;
+    }
+}
+
+inline void glBindSampler(GLuint, GLuint) {}
+
+inline void glSamplerParameteri(GLuint, GLenum, GLint) {}
+
+inline void glProgramBinary(GLuint, GLenum, const void *, GLsizei) {}
+
+inline void glGetProgramBinary(GLuint, GLsizei, GLsizei *length, GLenum *binaryFormat, void *)
+{
+    if (length)
+    {
+        *length = 0;
+    }
+    if (binaryFormat)
+    {
+        *binaryFormat = 0;
+    }
+}
+
+inline const GLubyte *glGetString(GLenum)
+{
+    return nullptr;
+}
+
 inline GLint glGetUniformLocation(GLuint, const GLchar *)
 {
     return -1;
@@ -225,12 +383,23 @@ inline GLint glGetUniformLocation(GLuint, const GLchar *)
 
 inline void glUseProgram(GLuint) {}
 
+inline GLuint glGetUniformBlockIndex(GLuint, const GLchar *)
+{
+    return GL_INVALID_INDEX;
+}
+
+inline void glUniformBlockBinding(GLuint, GLuint, GLuint) {}
+
+inline void glBindBufferRange(GLenum, GLuint, GLuint, GLintptr, GLsizeiptr) {}
+
 inline void glUniform1i(GLint, GLint) {}
 
 inline void glUniform1f(GLint, GLfloat) {}
 
 inline void glUniform2f(GLint, GLfloat, GLfloat) {}
 
+inline void glUniform3i(GLint, GLint, GLint, GLint) {}
+
 inline void glUniform4f(GLint, GLfloat, GLfloat, GLfloat, GLfloat) {}
 
 inline void glUniformMatrix4fv(GLint, GLsizei, GLboolean, const GLfloat *) {}
@@ -259,6 +428,49 @@ inline void glBindBuffer(GLenum, GLuint) {}
 
 inline void glBufferData(GLenum, GLsizeiptr, const void *, GLenum) {}
 
+inline void glBufferSubData(GLenum, GLintptr, GLsizeiptr, const void *) {}
+
+inline void glGetBufferSubData(GLenum, GLintptr, GLsizeiptr, void *) {}
+
+inline void glBufferStorage(GLenum, GLsizeiptr, const void *, GLbitfield) {}
+
+inline void *glMapBufferRange(GLenum, GLintptr, GLsizeiptr, GLbitfield)
+{
+    return nullptr;
+}
+
+inline GLboolean glUnmapBuffer(GLenum)
+{
+    return GL_TRUE;
+}
+
+inline void glDeleteBuffers(GLsizei, const GLuint *) {}
+
+inline GLsync glFenceSync(GLenum, GLbitfield)
+{
+    return nullptr;
+}
+
+inline GLenum glClientWaitSync(GLsync, GLbitfield, GLuint64)
+{
+    return GL_ALREADY_SIGNALED;
+}
+
+inline void glDeleteSync(GLsync) {}
+
+inline void glGetIntegerv(GLenum, GLint *params)
+{
+    if (params)
+    {
+        *params = 0;
+    }
+}
+
+inline const GLubyte *glGetStringi(GLenum, GLuint)
+{
+    return nullptr;
+}
+
 inline void glEnableVertexAttribArray(GLuint) {}
 
 inline void glVertexAttribPointer(GLuint, GLint, GLenum, GLboolean, GLsizei, const void *) {}
@@ -281,6 +493,8 @@ inline void glGenFramebuffers(GLsizei n, GLuint *framebuffers)
 
 inline void glFramebufferTexture2D(GLenum, GLenum, GLenum, GLuint, GLint) {}
 
+inline void glBlitFramebuffer(GLint, GLint, GLint, GLint, GLint, GLint, GLint, GLint, GLbitfield, GLenum) {}
+
 inline void glGenTextures(GLsizei n, GLuint *textures)
 {
     static GLuint counter = 400;
@@ -298,10 +512,21 @@ inline void glTexSubImage2D(GLenum, GLint, GLint, GLint, GLsizei, GLsizei, GLenu
 
 inline void glTexParameteri(GLenum, GLenum, GLint) {}
 
+inline void glGenerateMipmap(GLenum) {}
+
+inline void glPixelStorei(GLenum, GLint) {}
+
 inline void glReadBuffer(GLenum) {}
 
+inline void glReadPixels(GLint, GLint, GLsizei, GLsizei, GLenum, GLenum, void *) {}
+
 inline void glActiveTexture(GLenum) {}
 
+inline void glCopyImageSubData(GLuint, GLenum, GLint, GLint, GLint, GLint, GLuint, GLenum, GLint, GLint, GLint, GLint,
+                               GLsizei, GLsizei, GLsizei)
+{
+}
+
 inline void glCopyTexSubImage2D(GLenum, GLint, GLint, GLint, GLint, GLint, GLsizei, GLsizei) {}
 
 inline void glDrawArrays(GLenum, GLint, GLsizei) {}
@@ -312,6 +537,10 @@ inline void glClear(GLenum) {}
 
 inline void glEnable(GLenum) {}
 
+inline void glDisable(GLenum) {}
+
+inline void glScissor(GLint, GLint, GLsizei, GLsizei) {}
+
 inline void glBlendFunc(GLenum, GLenum) {}
 
 inline void glViewport(GLint, GLint, GLsizei, GLsizei) {}